@@ -0,0 +1,596 @@
+/* fss_bench.c */
+// load generator and benchmark driver: starts ./fss_manager on generated
+// source/target pairs, runs one workload against it and writes the results
+// as JSON
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <stdint.h>
+
+#define PATH_LEN 1024
+#define OUT_BUF  65536
+
+// --- options ---
+static const char *workdir = "bench_data";
+static const char *workload = "small";
+static const char *out_path = NULL;    // -o, stdout when unset
+static int    pairs = 4;
+static int    nfiles = 1000;           // per workload, spread over the pairs
+static size_t file_size = 4096;        // small files; large files use large_size
+static size_t large_size = 8 << 20;
+static int    rounds = 5;              // large: rewrite rounds
+static int    depth = 6;               // deep: directory levels
+static double timeout_s = 60;
+static uint64_t seed = 1;
+static char **manager_args = NULL;     // after "--", passed to fss_manager
+static int    nmanager_args = 0;
+
+// --- file bookkeeping ---
+typedef struct bench_file {
+    char src[PATH_LEN];
+    char dst[PATH_LEN];
+    char *data;                // expected content
+    size_t size;
+    long long written_ns;      // the source write finished
+    long long synced_ns;       // the target first matched, 0 = not yet
+} bench_file_t;
+
+static bench_file_t *files = NULL;
+static int files_count = 0, files_cap = 0;
+
+static pid_t manager_pid = -1;
+static int fifo_in_fd = -1, fifo_out_fd = -1;
+static int sync_acks = 0;              // "Syncing directory" lines seen on fss_out
+static char out_line[4096];
+static size_t out_line_len = 0;
+static long rss_peak_kb = 0;
+static int checks_failed = 0;          // a workload's own check, besides the file contents
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift64*: the same seed always produces the same tree and contents
+uint64_t next_random(void) {
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ULL;
+}
+
+void fill_random(char *buf, size_t len) {
+    for (size_t i = 0; i < len; i += 8) {
+        uint64_t v = next_random();
+        memcpy(buf + i, &v, len - i < 8 ? len - i : 8);
+    }
+}
+
+int mkdirs(const char *path) {
+    char tmp[PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) < 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return mkdir(tmp, 0755) < 0 && errno != EEXIST ? -1 : 0;
+}
+
+bench_file_t *add_file(int pair, const char *rel, size_t size) {
+    if (files_count == files_cap) {
+        files_cap = files_cap ? files_cap * 2 : 1024;
+        files = realloc(files, files_cap * sizeof(bench_file_t));
+    }
+    bench_file_t *f = &files[files_count++];
+    snprintf(f->src, sizeof(f->src), "%s/src%d/%s", workdir, pair, rel);
+    snprintf(f->dst, sizeof(f->dst), "%s/dst%d/%s", workdir, pair, rel);
+    f->data = malloc(size ? size : 1);
+    f->size = size;
+    fill_random(f->data, size);
+    f->written_ns = f->synced_ns = 0;
+    return f;
+}
+
+int write_file(bench_file_t *f) {
+    int fd = open(f->src, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror(f->src); return -1; }
+    size_t off = 0;
+    while (off < f->size) {
+        ssize_t n = write(fd, f->data + off, f->size - off);
+        if (n < 0) { perror("write"); close(fd); return -1; }
+        off += n;
+    }
+    close(fd);
+    f->written_ns = now_ns();
+    f->synced_ns = 0;
+    return 0;
+}
+
+// --- manager process ---
+// lines of the manager log containing needle; startup waits on the FULL
+// reports there, since the manager no longer holds them for a console
+int count_log_lines(const char *path, const char *needle) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+    char line[4096];
+    int count = 0;
+    while (fgets(line, sizeof(line), fp))
+        if (strstr(line, needle)) count++;
+    fclose(fp);
+    return count;
+}
+
+// drain fss_out, counting "Syncing directory" acknowledgements
+void drain_manager_output(void) {
+    char buf[OUT_BUF];
+    ssize_t n;
+    while ((n = read(fifo_out_fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != '\n') {
+                if (out_line_len < sizeof(out_line) - 1) out_line[out_line_len++] = buf[i];
+                continue;
+            }
+            out_line[out_line_len] = '\0';
+            if (strstr(out_line, "] Syncing directory: ")) sync_acks++;
+            out_line_len = 0;
+        }
+    }
+}
+
+void send_command(const char *cmd) {
+    char line[PATH_LEN + 16];
+    int n = snprintf(line, sizeof(line), "%s\n", cmd);
+    if (write(fifo_in_fd, line, n) != n) perror("write fss_in");
+}
+
+typedef struct proc_sample {
+    long long utime, stime, cutime, cstime;   // clock ticks
+    long rss_kb;
+} proc_sample_t;
+
+// manager CPU from /proc/<pid>/stat (its own and that of reaped workers) and RSS from status
+int sample_manager(proc_sample_t *s) {
+    char path[64], buf[4096];
+    memset(s, 0, sizeof(*s));
+    snprintf(path, sizeof(path), "/proc/%d/stat", manager_pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+    char *p = strrchr(buf, ')');   // comm may contain spaces
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lld %lld %lld %lld",
+                     &s->utime, &s->stime, &s->cutime, &s->cstime) != 4)
+        return -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", manager_pid);
+    fp = fopen(path, "r");
+    if (!fp) return -1;
+    while (fgets(buf, sizeof(buf), fp)) {
+        if (!strncmp(buf, "VmRSS:", 6)) s->rss_kb = atol(buf + 6);
+        if (!strncmp(buf, "VmHWM:", 6)) {
+            long hwm = atol(buf + 6);
+            if (hwm > rss_peak_kb) rss_peak_kb = hwm;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+int start_manager(void) {
+    char config[PATH_LEN], log[PATH_LEN];
+    snprintf(config, sizeof(config), "%s/config.txt", workdir);
+    snprintf(log, sizeof(log), "%s/manager.log", workdir);
+    FILE *cf = fopen(config, "w");
+    if (!cf) { perror(config); return -1; }
+    for (int i = 0; i < pairs; i++)
+        fprintf(cf, "%s/src%d %s/dst%d\n", workdir, i, workdir, i);
+    fclose(cf);
+    unlink("fss_in");
+    unlink("fss_out");
+    manager_pid = fork();
+    if (manager_pid < 0) { perror("fork"); return -1; }
+    if (manager_pid == 0) {
+        char *argv[64];
+        int n = 0;
+        argv[n++] = "fss_manager";
+        argv[n++] = "-l";
+        argv[n++] = log;
+        argv[n++] = "-c";
+        argv[n++] = config;
+        for (int i = 0; i < nmanager_args && n < 63; i++) argv[n++] = manager_args[i];
+        argv[n] = NULL;
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        execv("./fss_manager", argv);
+        perror("execv ./fss_manager");
+        _exit(1);
+    }
+    long long deadline = now_ns() + (long long)(timeout_s * 1e9);
+    while ((fifo_out_fd = open("fss_out", O_RDONLY | O_NONBLOCK)) < 0) {
+        if (now_ns() > deadline || waitpid(manager_pid, NULL, WNOHANG) == manager_pid) {
+            fprintf(stderr, "fss_manager did not start\n");
+            return -1;
+        }
+        usleep(10000);
+    }
+    while ((fifo_in_fd = open("fss_in", O_WRONLY | O_NONBLOCK)) < 0) {
+        if (now_ns() > deadline) { perror("open fss_in"); return -1; }
+        usleep(10000);
+    }
+    // every pair starts with a FULL sync
+    int full_reports = 0;
+    while ((full_reports = count_log_lines(log, "] [FULL] [")) < pairs && now_ns() < deadline) {
+        drain_manager_output();
+        usleep(10000);
+    }
+    return full_reports < pairs ? -1 : 0;
+}
+
+int stop_manager(void) {
+    send_command("shutdown");
+    int status = 0;
+    long long deadline = now_ns() + (long long)(timeout_s * 1e9);
+    while (waitpid(manager_pid, &status, WNOHANG) == 0) {
+        drain_manager_output();
+        if (now_ns() > deadline) {
+            fprintf(stderr, "fss_manager did not shut down; killing it\n");
+            kill(manager_pid, SIGKILL);
+            waitpid(manager_pid, &status, 0);
+            break;
+        }
+        usleep(1000);
+    }
+    close(fifo_in_fd);
+    close(fifo_out_fd);
+    return status;
+}
+
+// "sync" every pair back to back, then wait until each is acknowledged
+void sync_all_pairs(void) {
+    char cmd[PATH_LEN];
+    int acks = sync_acks;
+    for (int p = 0; p < pairs; p++) {
+        snprintf(cmd, sizeof(cmd), "sync %s/src%d", workdir, p);
+        send_command(cmd);
+    }
+    long long deadline = now_ns() + (long long)(timeout_s * 1e9);
+    while (sync_acks < acks + pairs && now_ns() < deadline) {
+        drain_manager_output();
+        usleep(200);
+    }
+}
+
+// --- propagation ---
+int target_matches(const bench_file_t *f, char *buf) {
+    struct stat st;
+    if (stat(f->dst, &st) < 0 || (size_t)st.st_size != f->size) return 0;
+    int fd = open(f->dst, O_RDONLY);
+    if (fd < 0) return 0;
+    size_t off = 0;
+    ssize_t n;
+    while (off < f->size && (n = read(fd, buf, f->size - off > OUT_BUF ? OUT_BUF : f->size - off)) > 0) {
+        if (memcmp(buf, f->data + off, n)) break;
+        off += n;
+    }
+    close(fd);
+    return off == f->size;
+}
+
+// poll the targets of files[from, to) until each matches its source content
+int wait_synced(int from, int to) {
+    static char buf[OUT_BUF];
+    long long deadline = now_ns() + (long long)(timeout_s * 1e9);
+    int left = to - from;
+    proc_sample_t s;
+    while (left > 0 && now_ns() < deadline) {
+        for (int i = from; i < to; i++) {
+            if (files[i].synced_ns || !target_matches(&files[i], buf)) continue;
+            files[i].synced_ns = now_ns();
+            left--;
+        }
+        drain_manager_output();
+        sample_manager(&s);
+        if (left) usleep(500);
+    }
+    return (to - from) - left;
+}
+
+// --- workloads ---
+// each returns the index of its first measured file; files before it only
+// set the stage and are not part of the results
+int workload_small(void) {
+    char rel[64];
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(rel, sizeof(rel), "small%d.dat", i);
+        write_file(add_file(i % pairs, rel, file_size));
+    }
+    wait_synced(0, files_count);
+    return 0;
+}
+
+// one large file per 100 small ones, rewritten in place a block at a time
+// for several rounds; only the rewrites are measured
+int workload_large(void) {
+    char rel[64];
+    int n = nfiles / 100 > 0 ? nfiles / 100 : 1;
+    for (int i = 0; i < n; i++) {
+        snprintf(rel, sizeof(rel), "large%d.dat", i);
+        write_file(add_file(i % pairs, rel, large_size));
+    }
+    wait_synced(0, files_count);
+    int first = files_count;
+    for (int r = 0; r < rounds; r++) {
+        int start = files_count;
+        for (int i = 0; i < n; i++) {
+            snprintf(rel, sizeof(rel), "large%d.dat", i);
+            bench_file_t *f = add_file(i % pairs, rel, 0);
+            bench_file_t *prev = &files[start - n + i];   // after add_file, which may move the array
+            f->size = prev->size;
+            f->data = realloc(f->data, f->size);
+            memcpy(f->data, prev->data, f->size);
+            // touch about 1% of the 64 KiB blocks
+            int fd = open(f->src, O_WRONLY);
+            if (fd < 0) { perror(f->src); continue; }
+            size_t blocks = f->size / 65536;
+            for (size_t b = 0; b < blocks / 100 + 1; b++) {
+                size_t off = (next_random() % blocks) * 65536;
+                fill_random(f->data + off, 65536);
+                if (pwrite(fd, f->data + off, 65536, off) != 65536) perror("pwrite");
+            }
+            close(fd);
+            f->written_ns = now_ns();
+        }
+        wait_synced(start, files_count);
+    }
+    return first;
+}
+
+// a tree the manager does not watch below its top level: written first, then
+// picked up by a "sync" of every pair, timed from the command
+int workload_deep(void) {
+    char rel[PATH_LEN];
+    int per_pair = nfiles / pairs + 1;
+    for (int p = 0; p < pairs; p++) {
+        for (int i = 0; i < per_pair; i++) {
+            int len = 0;
+            for (int d = 0, level = i % depth; d <= level; d++)
+                len += snprintf(rel + len, sizeof(rel) - len, "d%d/", d);
+            snprintf(rel + len, sizeof(rel) - len, "f%d.dat", i);
+            bench_file_t *f = add_file(p, rel, file_size);
+            char dir[PATH_LEN];
+            snprintf(dir, sizeof(dir), "%s", f->src);
+            *strrchr(dir, '/') = '\0';
+            mkdirs(dir);
+            write_file(f);
+        }
+    }
+    usleep(100000);   // let the top-level events settle first
+    long long start = now_ns();
+    sync_all_pairs();
+    for (int i = 0; i < files_count; i++) files[i].written_ns = start;
+    wait_synced(0, files_count);
+    return 0;
+}
+
+// renames are not watched, so churn is followed by a "sync" of every pair;
+// latency runs from the command to the new name matching in the target
+int workload_rename(void) {
+    char rel[64];
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(rel, sizeof(rel), "old%d.dat", i);
+        write_file(add_file(i % pairs, rel, file_size));
+    }
+    wait_synced(0, files_count);
+    int first = files_count;
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(rel, sizeof(rel), "new%d.dat", i);
+        bench_file_t *f = add_file(i % pairs, rel, 0);
+        bench_file_t *old = &files[i];
+        f->size = old->size;
+        f->data = realloc(f->data, f->size);
+        memcpy(f->data, old->data, f->size);
+        if (rename(old->src, f->src) < 0) perror("rename");
+    }
+    long long start = now_ns();
+    sync_all_pairs();
+    for (int i = first; i < files_count; i++) files[i].written_ns = start;
+    wait_synced(first, files_count);
+    return first;
+}
+
+// small-file storms and large-file writes at the same time, alternating pairs
+int workload_mixed(void) {
+    char rel[64];
+    int nlarge = nfiles / 100 > 0 ? nfiles / 100 : 1;
+    for (int i = 0, l = 0; i < nfiles; i++) {
+        snprintf(rel, sizeof(rel), "small%d.dat", i);
+        write_file(add_file((2 * i) % pairs, rel, file_size));
+        if (l < nlarge && i % (nfiles / nlarge + 1) == 0) {
+            snprintf(rel, sizeof(rel), "large%d.dat", l);
+            write_file(add_file((2 * l++ + 1) % pairs, rel, large_size));
+        }
+    }
+    wait_synced(0, files_count);
+    return 0;
+}
+
+// files named like the manager's own task variants (ALL, RESCAN, VERIFY,
+// REPAIR), written behind a small-file storm so they wait in the queue next
+// to a "verify" of the same pair: each file must reach its target and each
+// verify must report (a repair would copy a lost file again, so it is not used)
+int workload_names(void) {
+    static const char *names[] = { "ALL", "RESCAN", "VERIFY", "REPAIR" };
+    char rel[64], cmd[PATH_LEN], log[PATH_LEN];
+    for (int i = 0; i < nfiles; i++) {
+        snprintf(rel, sizeof(rel), "small%d.dat", i);
+        write_file(add_file(i % pairs, rel, file_size));
+    }
+    int first = files_count;
+    for (int p = 0; p < pairs; p++) {
+        for (int i = 0; i < 4; i++)
+            write_file(add_file(p, names[i], file_size));
+        snprintf(cmd, sizeof(cmd), "verify %s/src%d", workdir, p);
+        send_command(cmd);
+    }
+    wait_synced(0, files_count);
+    snprintf(log, sizeof(log), "%s/manager.log", workdir);
+    long long deadline = now_ns() + (long long)(timeout_s * 1e9);
+    int reports;
+    while ((reports = count_log_lines(log, "] [VERIFY] [")) < pairs && now_ns() < deadline) {
+        drain_manager_output();
+        usleep(10000);
+    }
+    if (reports < pairs) {
+        fprintf(stderr, "names: %d of %d verify reports\n", reports, pairs);
+        checks_failed = 1;
+    }
+    return first;
+}
+
+// --- results ---
+int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+double percentile_ms(const long long *sorted, int n, double q) {
+    if (!n) return 0;
+    int i = (int)(q * n);
+    if (i >= n) i = n - 1;
+    return sorted[i] / 1e6;
+}
+
+void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+void write_results(FILE *out, int first, double wall_s, const proc_sample_t *before,
+                   const proc_sample_t *after, int manager_status) {
+    int n = files_count - first, synced = 0;
+    long long *lat = malloc((n ? n : 1) * sizeof(long long));
+    long long first_write = 0, last_sync = 0;
+    double bytes = 0, sum = 0;
+    for (int i = first; i < files_count; i++) {
+        bench_file_t *f = &files[i];
+        if (!first_write || f->written_ns < first_write) first_write = f->written_ns;
+        if (!f->synced_ns) continue;
+        lat[synced++] = f->synced_ns - f->written_ns;
+        sum += f->synced_ns - f->written_ns;
+        bytes += f->size;
+        if (f->synced_ns > last_sync) last_sync = f->synced_ns;
+    }
+    qsort(lat, synced, sizeof(long long), cmp_ll);
+    double span_s = last_sync > first_write ? (last_sync - first_write) / 1e9 : 0;
+    double tick = sysconf(_SC_CLK_TCK);
+    fprintf(out, "{\n  \"workload\": ");
+    json_string(out, workload);
+    fprintf(out, ",\n  \"pairs\": %d,\n  \"files\": %d,\n  \"file_size\": %zu,\n  \"large_size\": %zu,\n"
+                 "  \"seed\": %llu,\n  \"manager_args\": [",
+            pairs, n, file_size, large_size, (unsigned long long)seed);
+    for (int i = 0; i < nmanager_args; i++) {
+        if (i) fputs(", ", out);
+        json_string(out, manager_args[i]);
+    }
+    fprintf(out, "],\n  \"files_synced\": %d,\n  \"files_missing\": %d,\n  \"wall_s\": %.3f,\n"
+                 "  \"throughput\": { \"files_per_s\": %.1f, \"mb_per_s\": %.3f },\n"
+                 "  \"latency_ms\": { \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+            synced, n - synced, wall_s,
+            span_s > 0 ? synced / span_s : 0, span_s > 0 ? bytes / span_s / (1 << 20) : 0,
+            synced ? sum / synced / 1e6 : 0, percentile_ms(lat, synced, 0.5), percentile_ms(lat, synced, 0.9),
+            percentile_ms(lat, synced, 0.99), synced ? lat[synced - 1] / 1e6 : 0);
+    fprintf(out, "  \"manager\": { \"cpu_user_s\": %.3f, \"cpu_sys_s\": %.3f, \"workers_cpu_s\": %.3f,"
+                 " \"rss_kb\": %ld, \"rss_peak_kb\": %ld, \"exit_status\": %d }\n}\n",
+            (after->utime - before->utime) / tick, (after->stime - before->stime) / tick,
+            (after->cutime + after->cstime - before->cutime - before->cstime) / tick,
+            after->rss_kb, rss_peak_kb, manager_status);
+    free(lat);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:o:n:f:s:S:r:D:t:R:")) != -1) {
+        switch (opt) {
+            case 'd': workdir = optarg; break;
+            case 'w': workload = optarg; break;
+            case 'o': out_path = optarg; break;
+            case 'n': pairs = atoi(optarg); break;
+            case 'f': nfiles = atoi(optarg); break;
+            case 's': file_size = strtoul(optarg, NULL, 10); break;
+            case 'S': large_size = strtoul(optarg, NULL, 10); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 'D': depth = atoi(optarg); break;
+            case 't': timeout_s = atof(optarg); break;
+            case 'R': seed = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "Usage: %s [-w small|large|deep|rename|mixed|names] [-n pairs] [-f files] [-s file_size]\n"
+                                "          [-S large_size] [-r rounds] [-D depth] [-t timeout_s] [-R seed]\n"
+                                "          [-d workdir] [-o results.json] [-- fss_manager options]\n", argv[0]);
+                return 1;
+        }
+    }
+    manager_args = argv + optind;
+    nmanager_args = argc - optind;
+    if (pairs < 1) pairs = 1;
+    if (nfiles < 1) nfiles = 1;
+    if (depth < 1) depth = 1;
+    if (!seed) seed = 1;
+    int (*run)(void) = NULL;
+    if (!strcmp(workload, "small")) run = workload_small;
+    else if (!strcmp(workload, "large")) run = workload_large;
+    else if (!strcmp(workload, "deep")) run = workload_deep;
+    else if (!strcmp(workload, "rename")) run = workload_rename;
+    else if (!strcmp(workload, "mixed")) run = workload_mixed;
+    else if (!strcmp(workload, "names")) run = workload_names;
+    if (!run) { fprintf(stderr, "Unknown workload: %s\n", workload); return 1; }
+    signal(SIGPIPE, SIG_IGN);
+
+    // a fresh tree each run, so runs with the same options are comparable
+    char path[PATH_LEN];
+    snprintf(path, sizeof(path), "rm -rf '%s'", workdir);
+    if (system(path) != 0) { fprintf(stderr, "cannot clear %s\n", workdir); return 1; }
+    for (int i = 0; i < pairs; i++) {
+        snprintf(path, sizeof(path), "%s/src%d", workdir, i);
+        mkdirs(path);
+        snprintf(path, sizeof(path), "%s/dst%d", workdir, i);
+        mkdirs(path);
+    }
+    uint64_t seed0 = seed;
+    if (start_manager() < 0) {
+        if (manager_pid > 0) { kill(manager_pid, SIGKILL); waitpid(manager_pid, NULL, 0); }
+        return 1;
+    }
+    proc_sample_t before, after;
+    sample_manager(&before);
+    long long t0 = now_ns();
+    int first = run();
+    double wall_s = (now_ns() - t0) / 1e9;
+    sample_manager(&after);
+    int status = stop_manager();
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) { perror(out_path); return 1; }
+    seed = seed0;
+    write_results(out, first, wall_s, &before, &after, status);
+    if (out != stdout) fclose(out);
+    for (int i = first; i < files_count; i++)
+        if (!files[i].synced_ns) return 2;
+    return checks_failed ? 2 : 0;
+}
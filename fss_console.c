@@ -5,10 +5,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define FIFO_IN  "fss_in"
 #define FIFO_OUT "fss_out"
+#define MAX_COMMAND 256
 
 // Helper to produce timestamp in [YYYY-MM-DD HH:MM:SS]
 void current_time_str(char *buffer, size_t size) {
@@ -17,14 +21,192 @@ void current_time_str(char *buffer, size_t size) {
     strftime(buffer, size, "[%Y-%m-%d %H:%M:%S]", tm);
 }
 
+// --- requests ---
+// every command goes out as "#<id> command"; the manager answers with
+// "=<id> line" lines closed by "=<id> END OK|ERROR", in request order.
+// Unprefixed lines are worker reports and are printed as they come
+static int fifo_in_fd = -1, fifo_out_fd = -1;
+static FILE *console_fp = NULL;
+static long next_id = 1;
+static long last_end = 0;          // highest id whose END was read
+static int  failed = 0;            // requests answered with END ERROR
+
+// commands are queued and written together, at most PIPE_BUF bytes at a
+// time so a write never interleaves with another console's
+static char send_buf[PIPE_BUF];
+static size_t send_len = 0;
+
+int flush_requests(void) {
+    size_t done = 0;
+    while (done < send_len) {
+        ssize_t n = write(fifo_in_fd, send_buf + done, send_len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("Error writing to " FIFO_IN);
+            return -1;
+        }
+        done += n;
+    }
+    send_len = 0;
+    return 0;
+}
+
+// log and queue one command; returns its id, -1 if it could not be sent
+long send_request(const char *command) {
+    char tbuf[32], line[MAX_COMMAND + 32];
+    current_time_str(tbuf, sizeof(tbuf));
+    fprintf(console_fp, "%s Command %s\n", tbuf, command);
+    fflush(console_fp);
+    int n = snprintf(line, sizeof(line), "#%ld %s\n", next_id, command);
+    if (send_len + n > sizeof(send_buf) && flush_requests() < 0) return -1;
+    memcpy(send_buf + send_len, line, n);
+    send_len += n;
+    return next_id++;
+}
+
+// --- replies ---
+static char reply_buf[65536];
+static size_t reply_len = 0;
+
+void handle_reply_line(const char *line) {
+    const char *text = line;
+    if (*line == '=') {
+        char *rest;
+        long id = strtol(line + 1, &rest, 10);
+        if (rest != line + 1 && *rest == ' ') {
+            if (!strncmp(rest + 1, "END ", 4)) {
+                last_end = id;
+                if (!strcmp(rest + 5, "ERROR")) failed++;
+                return;
+            }
+            text = rest + 1;
+        }
+    }
+    // print and log exactly what the manager sent, without the frame tag
+    printf("%s\n", text);
+    fprintf(console_fp, "%s\n", text);
+}
+
+// one blocking read of fss_out; returns -1 once the manager is gone
+int read_replies(void) {
+    ssize_t n = read(fifo_out_fd, reply_buf + reply_len, sizeof(reply_buf) - 1 - reply_len);
+    if (n < 0 && errno == EINTR) return 0;
+    if (n <= 0) {
+        if (n < 0) perror("Error reading from " FIFO_OUT);
+        return -1;
+    }
+    reply_len += n;
+    char *start = reply_buf, *nl;
+    while ((nl = memchr(start, '\n', reply_buf + reply_len - start))) {
+        *nl = '\0';
+        handle_reply_line(start);
+        start = nl + 1;
+    }
+    reply_len -= start - reply_buf;
+    memmove(reply_buf, start, reply_len);
+    // a line longer than the buffer is passed on in pieces
+    if (reply_len == sizeof(reply_buf) - 1) {
+        reply_buf[reply_len] = '\0';
+        handle_reply_line(reply_buf);
+        reply_len = 0;
+    }
+    fflush(stdout);
+    fflush(console_fp);
+    return 0;
+}
+
+// read one command line; the rest of an overlong line is discarded
+int read_command(FILE *in, char *command, size_t size) {
+    if (!fgets(command, size, in)) return 0;
+    size_t len = strcspn(command, "\n");
+    if (!command[len]) {
+        int c;
+        while ((c = fgetc(in)) != EOF && c != '\n');
+    }
+    command[len] = '\0';
+    return 1;
+}
+
+int is_shutdown(const char *command) {
+    char word[16] = "";
+    sscanf(command, "%15s", word);
+    return !strcmp(word, "shutdown");
+}
+
+// interactive: one command at a time, its whole reply before the next prompt
+void run_interactive(void) {
+    char command[MAX_COMMAND];
+    while (1) {
+        printf("> ");
+        fflush(stdout);
+        if (!read_command(stdin, command, sizeof(command)))
+            break;
+        if (!command[strspn(command, " \t")])
+            continue;
+        long id = send_request(command);
+        if (id < 0 || flush_requests() < 0) break;
+        while (last_end < id)
+            if (read_replies() < 0) return;
+        if (is_shutdown(command))
+            break;
+    }
+}
+
+// batch: commands from a file or stdin, up to window of them in flight, so
+// a long list costs one stream rather than a round trip per command
+void run_batch(FILE *in, int window) {
+    char command[MAX_COMMAND];
+    int more = 1;
+    while (more || last_end < next_id - 1) {
+        while (more && next_id - 1 - last_end < window) {
+            if (!read_command(in, command, sizeof(command))) { more = 0; break; }
+            if (!command[strspn(command, " \t")] || command[0] == '#') continue;
+            if (send_request(command) < 0) return;
+            if (is_shutdown(command)) more = 0;
+        }
+        if (flush_requests() < 0) return;
+        if (last_end < next_id - 1 && read_replies() < 0) {
+            fprintf(stderr, "Manager closed " FIFO_OUT " with %ld requests unanswered.\n",
+                    next_id - 1 - last_end);
+            failed++;
+            return;
+        }
+    }
+}
+
+// the manager's control socket serves any number of consoles at once; the
+// same connection carries requests and replies
+int connect_control(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
 int main(int argc, char *argv[]) {
-    char *console_logfile = NULL;
+    char *console_logfile = NULL, *command_file = NULL, *socket_path = NULL;
+    int window = 64;
     int opt;
-    while ((opt = getopt(argc, argv, "l:")) != -1) {
+    while ((opt = getopt(argc, argv, "l:f:w:s:")) != -1) {
         if (opt == 'l') {
             console_logfile = optarg;
+        } else if (opt == 'f') {
+            command_file = optarg;
+        } else if (opt == 'w') {
+            window = atoi(optarg);
+        } else if (opt == 's') {
+            socket_path = optarg;
         } else {
-            fprintf(stderr, "Usage: %s -l <console_logfile>\n", argv[0]);
+            fprintf(stderr, "Usage: %s -l <console_logfile> [-f <commands_file>|-] [-w in_flight] [-s control_socket]\n", argv[0]);
             exit(EXIT_FAILURE);
         }
     }
@@ -32,16 +214,33 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Console logfile required.\n");
         exit(EXIT_FAILURE);
     }
+    if (window < 1) window = 1;
 
-    FILE *console_fp = fopen(console_logfile, "a");
+    console_fp = fopen(console_logfile, "a");
     if (!console_fp) {
         perror("Error opening console log file");
         exit(EXIT_FAILURE);
     }
+    FILE *in = NULL;
+    if (command_file) {
+        in = strcmp(command_file, "-") ? fopen(command_file, "r") : stdin;
+        if (!in) {
+            perror(command_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (socket_path) {
+        fifo_in_fd = fifo_out_fd = connect_control(socket_path);
+        if (fifo_in_fd < 0) {
+            perror(socket_path);
+            fclose(console_fp);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // Open FIFO_IN (write end) with retry
-    int fifo_in_fd;
-    while (1) {
+    while (!socket_path) {
         fifo_in_fd = open(FIFO_IN, O_WRONLY | O_NONBLOCK);
         if (fifo_in_fd >= 0) break;
         if (errno == ENXIO || errno == ENOENT) {
@@ -52,10 +251,11 @@ int main(int argc, char *argv[]) {
         fclose(console_fp);
         exit(EXIT_FAILURE);
     }
+    // writes block from here on: the window bounds what is in flight
+    if (!socket_path) fcntl(fifo_in_fd, F_SETFL, fcntl(fifo_in_fd, F_GETFL) & ~O_NONBLOCK);
 
     // Open FIFO_OUT (read end) with retry
-    int fifo_out_fd;
-    while (1) {
+    while (!socket_path) {
         fifo_out_fd = open(FIFO_OUT, O_RDONLY );
         if (fifo_out_fd >= 0) break;
         if (errno == ENXIO || errno == ENOENT) {
@@ -68,54 +268,12 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    char command[256];
-    char response[2048];
-    char tbuf[32];
-
-    while (1) {
-        // Prompt user
-        printf("> ");
-        fflush(stdout);
-        if (!fgets(command, sizeof(command), stdin))
-            break;
-        // Strip newline
-        command[strcspn(command, "\n")] = '\0';
-
-        // Log command with timestamp
-        current_time_str(tbuf, sizeof(tbuf));
-        fprintf(console_fp, "%s Command %s\n", tbuf, command);
-        fflush(console_fp);
-
-        // Send command to manager (append newline)
-        char cmd_nl[260];
-        snprintf(cmd_nl, sizeof(cmd_nl), "%s\n", command);
-        if (write(fifo_in_fd, cmd_nl, strlen(cmd_nl)) < 0) {
-            perror("Error writing to " FIFO_IN);
-            break;
-        }
-
-        // Read response with a single blocking read
-        ssize_t n = read(fifo_out_fd, response, sizeof(response) - 1);
-        if (n < 0) {
-            perror("Error reading from " FIFO_OUT);
-        } else if (n > 0) {
-            response[n] = '\0';
-            // print and log exactly what έστειλε ο manager (περιλαμβάνει timestamps και newline)
-            fputs(response, stdout);
-            fputs(response, console_fp);
-            fflush(console_fp);
-        }
-
-        // Check for shutdown command
-        char cmd_copy[256];
-        strncpy(cmd_copy, command, sizeof(cmd_copy));
-        char *token = strtok(cmd_copy, " ");
-        if (token && strcmp(token, "shutdown") == 0)
-            break;
-    }
+    if (in) run_batch(in, window);
+    else run_interactive();
 
+    if (in && in != stdin) fclose(in);
     close(fifo_in_fd);
-    close(fifo_out_fd);
+    if (fifo_out_fd != fifo_in_fd) close(fifo_out_fd);
     fclose(console_fp);
-    return 0;
+    return in && failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -1,4 +1,5 @@
 /* fss_manager.c */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,78 +9,659 @@
 #include <signal.h>
 #include <sys/inotify.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <dirent.h>
+#include <limits.h>
+#include "fss_proto.h"
 
-#define MAX_LINE      256
+#define MAX_LINE      4096                             // a config line, its targets included
+#define TARGETS_LEN   (MAX_TARGETS * 256)              // a pair's joined target list
 #define EVENT_SIZE    (sizeof(struct inotify_event))
 #define EVENT_BUF_LEN (1024 * (EVENT_SIZE + 16))
+#define EVENT_BUF_MAX (1 << 20)                          // largest inotify read buffer
+#define REPORT_BUF    (sizeof(report_frame_t) + 4096)   // initial reassembly buffer
+#define HASH_BUCKETS  4096
+#define MAX_EVENTS    256
+// files written elsewhere and renamed in (as workers and many editors do)
+// arrive as moves, not creates
+#define WATCH_MASK    (IN_CREATE | IN_MODIFY | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM)
 
 // Forward declarations
-void spawn_worker(const char *source, const char *target, const char *filename, const char *operation);
+struct worker_pipe *spawn_worker(const char *source, const char *target, const char *filename,
+                                 const char *operation, long long event_ns);
 void current_time_str(char *buffer, size_t size);
 void log_message(const char *message);
+int  worker_available(void);
+int  find_sync_index(const char *source);
+long long drop_pending(int idx);
 
 // Global resources
-static FILE *log_fp = NULL;
-static int inotify_fd = -1;
-static int fifo_out_fd = -1;  // global so spawn_worker can access
+static int log_fd = -1;
+static int *inotify_fds = NULL;   // one inotify instance per watch shard
+static int inotify_shards = 4;    // -I
+static int epoll_fd = -1;     // inotify, control clients and every worker pipe, registered once
+static int control_fd = -1;   // listening control socket
+static int child_fd = -1;     // signalfd for SIGCHLD when pidfds are unavailable
+static int use_pidfd = 1;
+static sigset_t sigchld_mask;
+
+// --- metrics ---
+// log-linear latency histogram in the HdrHistogram manner: microseconds, 8
+// linear sub-buckets per power of two, so a quantile is off by at most 12.5%
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS  ((32 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)   // up to ~71 min
+typedef struct latency_hist {
+    uint32_t count[HIST_BUCKETS];
+    uint64_t total, sum_us, max_us;
+} latency_hist_t;
+
+// event->dispatch is time spent debounced and queued, dispatch->done the
+// worker's share, event->synced what a user waits for
+enum latency_stage { LAT_QUEUED, LAT_RUN, LAT_SYNCED, LAT_STAGES };
+static const char *const stage_names[LAT_STAGES] = { "event_to_dispatch", "dispatch_to_done", "event_to_synced" };
+
+typedef struct sync_stats {
+    long long events, events_coalesced;
+    long long events_dropped;  // arrived while the source was dirty
+    long long dispatches;      // tasks or batches handed to a worker
+    long long files_done, files_unchanged, files_failed;
+    long long bytes_written;
+    long long fsyncs, fsync_ns;
+    int  queued_peak;
+    latency_hist_t *latency;   // LAT_STAGES histograms; a source's come with its first sample
+} sync_stats_t;
+
+static latency_hist_t total_latency[LAT_STAGES];
+static sync_stats_t total_stats = { .latency = total_latency };   // every source together
+static long workers_forked = 0;
+static char *metrics_file = NULL;    // -m: Prometheus text file, rewritten every METRICS_PERIOD_MS
+#define METRICS_PERIOD_MS 5000
+static char *state_file = NULL;      // -s: checkpoint of the pairs, rewritten every STATE_PERIOD_MS
+#define STATE_PERIOD_MS 10000
+static int catchup_limit = 1;        // -r: restart catch-up FULLs running at once
+static int catchup_running = 0;
+
+int hist_bucket(uint64_t us) {
+    if (us >= 1ULL << 32) us = (1ULL << 32) - 1;
+    if (us < (1u << HIST_SUB_BITS)) return us;
+    int e = 63 - __builtin_clzll(us);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + ((us >> (e - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+// largest value that falls into bucket b
+uint64_t hist_bucket_max(int b) {
+    if (b < (1 << HIST_SUB_BITS)) return b;
+    int e = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t sub = b & ((1u << HIST_SUB_BITS) - 1);
+    return ((((uint64_t)1 << HIST_SUB_BITS) + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void hist_record(latency_hist_t *h, long long ns) {
+    uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+    h->count[hist_bucket(us)]++;
+    h->total++;
+    h->sum_us += us;
+    if (us > h->max_us) h->max_us = us;
+}
+
+uint64_t hist_quantile(const latency_hist_t *h, double q) {
+    if (!h->total) return 0;
+    uint64_t rank = (uint64_t)(q * h->total);
+    if (rank < q * h->total || rank == 0) rank++;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->count[b];
+        if (seen >= rank) {
+            uint64_t v = hist_bucket_max(b);
+            return v < h->max_us ? v : h->max_us;
+        }
+    }
+    return h->max_us;
+}
 
 // --- sync_info structure ---
+// task classes in priority order: single-file copies, deletions, FULL syncs
+enum task_class { CLASS_COPY, CLASS_DELETE, CLASS_FULL, TASK_CLASSES };
+typedef struct task_fifo {
+    struct task *head, *tail;
+} task_fifo_t;
+
+// one of the directories a source is mirrored into; targets are only ever
+// added to a pair
+typedef struct sync_target {
+    char dir[256];
+    char last_result[16];
+    int  error_count;
+} sync_target_t;
+
 typedef struct sync_info {
     char source_dir[256];
-    char target_dir[256];
+    char *target_dir;          // the targets as workers take them, joined by TARGET_SEP
+    sync_target_t *targets;
+    int  target_count;
     int  active;               // 1=monitoring, 0=stopped
-    char last_result[16];      // SUCCESS / PARTIAL / ERROR / NONE
+    char last_result[16];      // SUCCESS / PARTIAL / ERROR / NONE, over all targets
     char last_sync_time[32];
     int  error_count;
     int  inotify_watch;
-    struct sync_info *next;
+    int  watch_shard;          // inotify instance the watch lives on
+    int  pending;              // events waiting in the coalescer
+    int  dirty;                // backlog given up on until its RESCAN is dispatched
+    // this source's share of the task scheduler
+    task_fifo_t queue[TASK_CLASSES];
+    int  credit[TASK_CLASSES]; // tasks each class may still run this round
+    int  queued;               // live tasks across all classes
+    int  ready_next;           // next source on the ready ring, -1 = last
+    int  ready;                // on the ready ring
+    sync_stats_t stats;
+    // directory change token (source mtime/ctime in ns) the target is known
+    // to be in sync with; saved in the -s checkpoint
+    long long token_mtime, token_ctime;
+    int  catchup;              // waiting for its restart catch-up FULL
 } sync_info_t;
-static sync_info_t *sync_info_head = NULL;
+// records live in one growable array and are never removed (cancel only
+// deactivates them); code keeps table indexes, not pointers, across additions
+static sync_info_t *sync_table = NULL;
+static int sync_count = 0, sync_capacity = 0;
+
+// open-addressing index over sync_table, linear probing with backward-shift delete
+typedef struct index_slot {
+    unsigned hash;
+    int idx;                   // sync_table index, -1 = empty
+} index_slot_t;
+typedef struct index_table {
+    index_slot_t *slots;
+    unsigned mask;             // capacity - 1, capacity is a power of two
+    unsigned used;
+} index_table_t;
+static index_table_t source_index;   // by source_dir
+static index_table_t watch_index;    // by inotify_watch
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+unsigned hash_str(const char *s) {
+    unsigned h = 2166136261u;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+unsigned hash_int(int v) {
+    unsigned h = (unsigned)v * 2654435761u;
+    return h ^ (h >> 16);
+}
+
+// --- interned filenames ---
+// queued tasks share one copy of each filename. Names live in a growable
+// arena as a name_hdr_t followed by the string and are found through an
+// open-addressing table of arena offsets. A name whose last reference goes
+// leaves the table and its block goes on a free list by size class, so a
+// steady backlog reuses the space of finished tasks; when no name is
+// referenced at all the whole arena is reset.
+typedef struct name_hdr {
+    uint32_t refs;
+    uint32_t hash;             // free blocks: offset + 1 of the next free block
+} name_hdr_t;
+#define NAME_SMALL_CLASSES 256 // blocks up to 1 KiB, in steps of 4 bytes; larger ones by power of two
+#define NAME_CLASSES       (NAME_SMALL_CLASSES + 32)
+static char *name_arena = NULL;
+static size_t name_arena_len = 0, name_arena_cap = 0;
+static uint32_t *name_slots = NULL;   // arena offset + 1, 0 = empty
+static unsigned name_mask = 0, name_used = 0;
+static int names_live = 0;            // names with refs > 0
+static uint32_t name_free[NAME_CLASSES];   // offset + 1 of the first free block, 0 = none
+
+const char *name_str(uint32_t off) {
+    return name_arena + off + sizeof(name_hdr_t);
+}
+
+static name_hdr_t *name_hdr(uint32_t off) {
+    return (name_hdr_t *)(name_arena + off);
+}
+
+void name_slots_grow(void) {
+    unsigned cap = name_slots ? (name_mask + 1) * 2 : 1024;
+    uint32_t *slots = calloc(cap, sizeof(uint32_t));
+    for (unsigned i = 0; name_slots && i <= name_mask; i++) {
+        if (!name_slots[i]) continue;
+        unsigned j = name_hdr(name_slots[i] - 1)->hash & (cap - 1);
+        while (slots[j]) j = (j + 1) & (cap - 1);
+        slots[j] = name_slots[i];
+    }
+    free(name_slots);
+    name_slots = slots;
+    name_mask = cap - 1;
+}
+
+// the size class of a block of need bytes; need is rounded up to the class size
+static int name_class(size_t *need) {
+    if (*need <= NAME_SMALL_CLASSES * 4) return *need / 4 - 1;
+    int c = NAME_SMALL_CLASSES;
+    size_t size = NAME_SMALL_CLASSES * 8;
+    while (size < *need) { size *= 2; c++; }
+    *need = size;
+    return c;
+}
+
+// returns the arena offset of name with one more reference
+uint32_t intern_name(const char *name) {
+    if (!name_slots || (name_used + 1) * 2 > name_mask + 1) name_slots_grow();
+    unsigned h = hash_str(name), i = h & name_mask;
+    for (; name_slots[i]; i = (i + 1) & name_mask) {
+        uint32_t off = name_slots[i] - 1;
+        if (name_hdr(off)->hash == h && !strcmp(name_str(off), name)) {
+            name_hdr(off)->refs++;
+            return off;
+        }
+    }
+    size_t need = (sizeof(name_hdr_t) + strlen(name) + 1 + 3) & ~(size_t)3;
+    int c = name_class(&need);
+    uint32_t off;
+    if (name_free[c]) {
+        off = name_free[c] - 1;
+        name_free[c] = name_hdr(off)->hash;
+    } else {
+        if (name_arena_len + need > name_arena_cap) {
+            name_arena_cap = name_arena_cap ? name_arena_cap * 2 : 65536;
+            while (name_arena_len + need > name_arena_cap) name_arena_cap *= 2;
+            name_arena = realloc(name_arena, name_arena_cap);
+        }
+        off = name_arena_len;
+        name_arena_len += need;
+    }
+    name_hdr(off)->refs = 1;
+    name_hdr(off)->hash = h;
+    strcpy(name_arena + off + sizeof(name_hdr_t), name);
+    name_slots[i] = off + 1;
+    name_used++;
+    names_live++;
+    return off;
+}
+
+// take off out of the probe table, moving later entries of its run back so
+// that every remaining name is still found from its home slot
+static void name_unslot(uint32_t off) {
+    unsigned i = name_hdr(off)->hash & name_mask;
+    while (name_slots[i] != off + 1) i = (i + 1) & name_mask;
+    for (unsigned j = (i + 1) & name_mask; name_slots[j]; j = (j + 1) & name_mask) {
+        unsigned home = name_hdr(name_slots[j] - 1)->hash & name_mask;
+        // j's entry may fill the hole at i unless its home lies in (i, j]
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            name_slots[i] = name_slots[j];
+            i = j;
+        }
+    }
+    name_slots[i] = 0;
+    name_used--;
+}
+
+void release_name(uint32_t off) {
+    if (--name_hdr(off)->refs > 0) return;
+    if (--names_live == 0) {
+        memset(name_slots, 0, (name_mask + 1) * sizeof(uint32_t));
+        memset(name_free, 0, sizeof(name_free));
+        name_used = 0;
+        name_arena_len = 0;
+        return;
+    }
+    size_t need = (sizeof(name_hdr_t) + strlen(name_str(off)) + 1 + 3) & ~(size_t)3;
+    int c = name_class(&need);
+    name_unslot(off);
+    name_hdr(off)->hash = name_free[c];
+    name_free[c] = off + 1;
+}
 
 // --- task queue ---
+// every source has one FIFO per task class; sources with work wait on a ready
+// ring and are served round-robin, one task per turn, so a burst on one
+// directory cannot delay the others. Within a source the classes share turns
+// by weight (deficit round-robin), higher classes first.
 typedef struct task {
-    char source[256];
-    char target[256];
-    char filename[256];
-    char operation[16];
+    int32_t  si;               // sync_table index; source and target come from there
+    uint32_t name;             // interned filename
+    uint8_t  operation;        // enum report_op
+    uint8_t  scope;            // enum task_scope
+    uint8_t  indexed;          // still the latest queued task for (source, filename)
+    uint8_t  cancelled;        // superseded by a later task; freed when reached
+    long long event_ns;        // oldest inotify event behind the task, 0 if none
     struct task *next;
+    struct task *hnext;        // queued_index chain
 } task_t;
-static task_t *task_queue_head = NULL, *task_queue_tail = NULL;
-
-void enqueue_task(const char *source, const char *target, const char *filename, const char *operation) {
-    task_t *new_task = malloc(sizeof(task_t));
-    strncpy(new_task->source, source, sizeof(new_task->source));
-    strncpy(new_task->target, target, sizeof(new_task->target));
-    strncpy(new_task->filename, filename, sizeof(new_task->filename));
-    strncpy(new_task->operation, operation, sizeof(new_task->operation));
+static const int class_weight[TASK_CLASSES] = { 8, 4, 1 };
+// FULL and VERIFY never name a file: their filename only picks the variant
+// handed to the worker. The scope keeps them apart from real files that
+// happen to be called "ALL" or "VERIFY"
+enum task_scope { SCOPE_FILE, SCOPE_ALL, SCOPE_RESCAN, SCOPE_VERIFY, SCOPE_REPAIR };
+static int ready_head = -1, ready_tail = -1;   // ring of sync_table indexes
+static int max_queued = 1024;  // per source; -q
+static int batch_files = 64;   // -b: queued files one worker takes at once
+// latest queued task per (source, filename), used to drop duplicates
+static task_t *queued_index[HASH_BUCKETS];
+static int tasks_dropped = 0;
+static int rescans_queued = 0;
+static int inotify_overflows = 0;
+static char *event_buf = NULL;        // inotify reads, sized by drain_inotify()
+static size_t event_buf_len = 0;
+
+// tasks come from slabs of TASK_SLAB and go back to a free list, never to malloc
+#define TASK_SLAB 1024
+static task_t *free_tasks = NULL;
+
+task_t *alloc_task(void) {
+    if (!free_tasks) {
+        task_t *slab = malloc(TASK_SLAB * sizeof(task_t));
+        if (!slab) return NULL;
+        for (int i = 0; i < TASK_SLAB; i++) {
+            slab[i].next = free_tasks;
+            free_tasks = &slab[i];
+        }
+    }
+    task_t *t = free_tasks;
+    free_tasks = t->next;
+    return t;
+}
+
+void free_task(task_t *t) {
+    release_name(t->name);
+    t->next = free_tasks;
+    free_tasks = t;
+}
+
+int task_scope(int operation, const char *filename) {
+    if (operation == OP_FULL) return strcmp(filename, "RESCAN") ? SCOPE_ALL : SCOPE_RESCAN;
+    if (operation == OP_VERIFY) return strcmp(filename, "REPAIR") ? SCOPE_VERIFY : SCOPE_REPAIR;
+    return SCOPE_FILE;
+}
+
+// a RESCAN redoes every copy and deletion of its source, but not a verify
+int replaced_by_rescan(int scope) {
+    return scope == SCOPE_FILE || scope == SCOPE_ALL || scope == SCOPE_RESCAN;
+}
+
+unsigned task_bucket(int si, int scope, uint32_t name) {
+    return ((hash_int(si) * 31u + hash_int(name)) * 31u + scope) % HASH_BUCKETS;
+}
+
+// interned names compare by offset
+task_t *find_queued_task(int si, int scope, uint32_t name) {
+    for (task_t *t = queued_index[task_bucket(si, scope, name)]; t; t = t->hnext)
+        if (t->si == si && t->scope == scope && t->name == name)
+            return t;
+    return NULL;
+}
+
+void unindex_task(task_t *task) {
+    task_t **curr = &queued_index[task_bucket(task->si, task->scope, task->name)];
+    while (*curr) {
+        if (*curr == task) {
+            *curr = task->hnext;
+            task->indexed = 0;
+            return;
+        }
+        curr = &((*curr)->hnext);
+    }
+}
+
+// ADDED and MODIFIED both copy the current file, so either satisfies the other
+int same_effect(int op1, int op2) {
+    int copy1 = op1 == OP_ADDED || op1 == OP_MODIFIED;
+    int copy2 = op2 == OP_ADDED || op2 == OP_MODIFIED;
+    return (copy1 && copy2) || op1 == op2;
+}
+
+int task_class(int operation) {
+    if (operation == OP_FULL || operation == OP_VERIFY) return CLASS_FULL;
+    if (operation == OP_DELETED) return CLASS_DELETE;
+    return CLASS_COPY;
+}
+
+void make_ready(int idx) {
+    sync_info_t *si = &sync_table[idx];
+    if (si->ready) return;
+    si->ready = 1;
+    si->ready_next = -1;
+    if (ready_tail < 0) ready_head = idx;
+    else sync_table[ready_tail].ready_next = idx;
+    ready_tail = idx;
+}
+
+// the task stays in its FIFO until reached, so only the counters change here
+void cancel_task(task_t *task) {
+    if (task->indexed) unindex_task(task);
+    task->cancelled = 1;
+    sync_table[task->si].queued--;
+}
+
+// takes over the caller's reference to name
+int push_task(int idx, int scope, uint32_t name, int operation, long long event_ns) {
+    task_t *new_task = alloc_task();
+    if (!new_task) {
+        release_name(name);
+        return 0;
+    }
+    sync_info_t *si = &sync_table[idx];
+    new_task->si = idx;
+    new_task->name = name;
+    new_task->operation = operation;
+    new_task->scope = scope;
+    new_task->cancelled = 0;
+    new_task->event_ns = event_ns;
     new_task->next = NULL;
-    if (!task_queue_tail) {
-        task_queue_head = task_queue_tail = new_task;
-    } else {
-        task_queue_tail->next = new_task;
-        task_queue_tail = new_task;
+    unsigned b = task_bucket(idx, scope, name);
+    new_task->hnext = queued_index[b];
+    queued_index[b] = new_task;
+    new_task->indexed = 1;
+    task_fifo_t *f = &si->queue[task_class(operation)];
+    if (!f->tail) f->head = f->tail = new_task;
+    else {
+        f->tail->next = new_task;
+        f->tail = new_task;
     }
+    si->queued++;
+    if (si->queued > si->stats.queued_peak) si->stats.queued_peak = si->queued;
+    make_ready(idx);
+    return 1;
 }
 
-task_t* dequeue_task() {
-    if (!task_queue_head) return NULL;
-    task_t *t = task_queue_head;
-    task_queue_head = t->next;
-    if (!task_queue_head) task_queue_tail = NULL;
+// a source whose backlog passed max_queued, or whose events were lost to an
+// inotify overflow, stops queueing per-file work: what is queued or pending
+// for it goes, replaced by one RESCAN (a FULL sync that also removes target
+// entries the source no longer has). Until that RESCAN is dispatched its
+// events are dropped; the rescan sees their effect anyway. Queued verifies
+// stay where they are
+void mark_dirty(int idx, const char *why) {
+    sync_info_t *si = &sync_table[idx];
+    if (si->dirty || !si->active) return;
+    si->dirty = 1;
+    long long event_ns = drop_pending(idx);
+    for (int c = 0; c < TASK_CLASSES; c++) {
+        task_fifo_t *f = &si->queue[c];
+        task_t *t = f->head;
+        f->head = f->tail = NULL;
+        while (t) {
+            task_t *next = t->next;
+            if (!t->cancelled && !replaced_by_rescan(t->scope)) {
+                t->next = NULL;
+                if (!f->tail) f->head = t;
+                else f->tail->next = t;
+                f->tail = t;
+            } else {
+                if (!t->cancelled) {
+                    if (t->event_ns && (!event_ns || t->event_ns < event_ns)) event_ns = t->event_ns;
+                    cancel_task(t);
+                }
+                free_task(t);
+            }
+            t = next;
+        }
+    }
+    rescans_queued++;
+    char msg[512];
+    snprintf(msg, sizeof(msg), "%s: %s; rescan queued.", si->source_dir, why);
+    log_message(msg);
+    push_task(idx, SCOPE_RESCAN, intern_name("RESCAN"), OP_FULL, event_ns);
+}
+
+// returns 0 when the task is redundant with what is already queued
+int enqueue_task(const char *source, const char *filename, const char *operation, long long event_ns) {
+    int idx = find_sync_index(source);
+    if (idx < 0) return 0;
+    int op = op_from_name(operation);
+    int scope = task_scope(op, filename);
+    // the queued RESCAN of a dirty source covers every copy and deletion
+    if (sync_table[idx].dirty && (scope == SCOPE_FILE || scope == SCOPE_ALL)) {
+        tasks_dropped++;
+        return 0;
+    }
+    uint32_t name = intern_name(filename);
+    task_t *prev = find_queued_task(idx, scope, name);
+    if (prev && same_effect(prev->operation, op)) {
+        tasks_dropped++;
+        release_name(name);
+        return 0;
+    }
+    // the newest operation decides the file's final state, and classes run out
+    // of arrival order, so an older task for the same file must not run at all
+    if (prev) {
+        if (prev->event_ns && (!event_ns || prev->event_ns < event_ns)) event_ns = prev->event_ns;
+        cancel_task(prev);
+    }
+    // a queued FULL copies every file it finds, after anything queued before it;
+    // it does not prune like a RESCAN
+    if (scope == SCOPE_FILE && op != OP_DELETED) {
+        uint32_t all = intern_name("ALL");
+        task_t *full = find_queued_task(idx, SCOPE_ALL, all);
+        release_name(all);
+        if (full) {
+            tasks_dropped++;
+            release_name(name);
+            return 0;
+        }
+    }
+    if (sync_table[idx].queued + sync_table[idx].pending >= max_queued && task_class(op) != CLASS_FULL) {
+        release_name(name);
+        char why[64];
+        snprintf(why, sizeof(why), "backlog over %d tasks", max_queued);
+        mark_dirty(idx, why);
+        return 1;
+    }
+    return push_task(idx, scope, name, op, event_ns);
+}
+
+// next live task of one class, freeing cancelled ones on the way
+task_t *fifo_peek(task_fifo_t *f) {
+    while (f->head && f->head->cancelled) {
+        task_t *t = f->head;
+        f->head = t->next;
+        free_task(t);
+    }
+    if (!f->head) f->tail = NULL;
+    return f->head;
+}
+
+// highest class that still has credit this round; a new round starts when
+// every class with work has used its share
+int pick_class(sync_info_t *si) {
+    for (int round = 0; round < 2; round++) {
+        for (int c = 0; c < TASK_CLASSES; c++)
+            if (si->credit[c] > 0 && fifo_peek(&si->queue[c])) {
+                si->credit[c]--;
+                return c;
+            }
+        for (int c = 0; c < TASK_CLASSES; c++)
+            si->credit[c] = fifo_peek(&si->queue[c]) ? class_weight[c] : 0;
+    }
+    return -1;
+}
+
+// unlink the live head of one class
+task_t *pop_task(sync_info_t *si, int c) {
+    task_fifo_t *f = &si->queue[c];
+    task_t *t = f->head;
+    f->head = t->next;
+    if (!f->head) f->tail = NULL;
+    if (t->indexed) unindex_task(t);
+    si->queued--;
     return t;
 }
 
+task_t* dequeue_task() {
+    while (ready_head >= 0) {
+        int idx = ready_head;
+        sync_info_t *si = &sync_table[idx];
+        ready_head = si->ready_next;
+        if (ready_head < 0) ready_tail = -1;
+        si->ready = 0;
+        int c = pick_class(si);
+        if (c < 0) continue;   // only cancelled tasks were left
+        task_t *t = pop_task(si, c);
+        if (si->queued > 0) make_ready(idx);
+        return t;
+    }
+    return NULL;
+}
+
+// bytes a task takes up in a BATCH: "<filename>\t<operation>\n"
+size_t batch_line_len(const task_t *t) {
+    return strlen(name_str(t->name)) + strlen(op_name(t->operation)) + 2;
+}
+
+// queued copies and deletions of the same source ride along with t, so a
+// burst of small files costs one worker dispatch instead of one per file
+int gather_batch(task_t *t, task_t **batch) {
+    batch[0] = t;
+    if (batch_files <= 1 || task_class(t->operation) == CLASS_FULL) return 1;
+    sync_info_t *si = &sync_table[t->si];
+    size_t bytes = sizeof(si->source_dir) + strlen(si->target_dir) + 32 + batch_line_len(t);
+    int n = 1;
+    for (int c = CLASS_COPY; c <= CLASS_DELETE; c++) {
+        task_t *next;
+        while (n < batch_files && (next = fifo_peek(&si->queue[c]))) {
+            bytes += batch_line_len(next);
+            if (bytes > BATCH_MAX_BYTES) return n;
+            batch[n++] = pop_task(si, c);
+        }
+    }
+    return n;
+}
+
+void spawn_batch(task_t **batch, int n);
+
 void process_task_queue() {
-    extern int current_worker_count, worker_limit;
-    while (current_worker_count < worker_limit) {
+    task_t *batch[BATCH_MAX_FILES];
+    while (worker_available()) {
         task_t *t = dequeue_task();
         if (!t) break;
-        spawn_worker(t->source, t->target, t->filename, t->operation);
-        free(t);
+        int n = gather_batch(t, batch);
+        // from here on new events are queued again, behind the rescan
+        if (t->scope == SCOPE_RESCAN)
+            sync_table[t->si].dirty = 0;
+        if (n > 1) {
+            spawn_batch(batch, n);
+        } else {
+            sync_info_t *si = &sync_table[t->si];
+            spawn_worker(si->source_dir, si->target_dir, name_str(t->name), op_name(t->operation), t->event_ns);
+        }
+        for (int i = 0; i < n; i++)
+            free_task(batch[i]);
     }
 }
 
@@ -87,18 +669,64 @@ void process_task_queue() {
 typedef struct worker_pipe {
     pid_t pid;
     int fd;
+    int cmd_fd;                // task channel of a pool worker, -1 for one-shot workers
+    int pooled;                // long-lived pool worker, replaced when it exits
+    int busy;                  // pool worker currently running a task
+    int tasks_done;
+    int pidfd;                 // readable once the worker exits, -1 with the signalfd fallback
+    long long spawned_ns;
+    long long dispatched_ns;   // when the current task was handed over
+    long long event_ns;        // oldest inotify event behind it, 0 if none
+    int catchup;               // running a restart catch-up FULL
+    int repair;                // running a VERIFY whose mismatches are to be queued
     char source[256];
+    char target[TARGETS_LEN];  // the targets of the current task
+    char *frame;               // report bytes received so far, grown up to REPORT_FRAME_MAX
+    size_t frame_len, frame_cap;
     struct worker_pipe *next;
 } worker_pipe_t;
 static worker_pipe_t *worker_pipes = NULL;
 
-void add_worker_pipe(pid_t pid, int fd, const char *source) {
+worker_pipe_t *add_worker_pipe(pid_t pid, int fd, const char *source, const char *target) {
     worker_pipe_t *wp = malloc(sizeof(worker_pipe_t));
     wp->pid = pid;
     wp->fd  = fd;
-    strncpy(wp->source, source, sizeof(wp->source));
+    wp->cmd_fd = -1;
+    wp->pooled = 0;
+    wp->busy = 0;
+    wp->tasks_done = 0;
+    wp->spawned_ns = wp->dispatched_ns = now_ns();
+    wp->event_ns = 0;
+    wp->catchup = 0;
+    wp->repair = 0;
+    wp->pidfd = -1;
+    workers_forked++;
+    snprintf(wp->source, sizeof(wp->source), "%s", source);
+    snprintf(wp->target, sizeof(wp->target), "%s", target);
+    wp->frame_cap = REPORT_BUF;
+    wp->frame = malloc(wp->frame_cap);
+    wp->frame_len = 0;
     wp->next = worker_pipes;
     worker_pipes = wp;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = wp };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) perror("epoll_ctl");
+    // exits are reaped in the main loop; every pidfd shares the child_fd tag
+    if (use_pidfd) {
+        wp->pidfd = syscall(SYS_pidfd_open, pid, 0);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &child_fd;
+        if (wp->pidfd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wp->pidfd, &ev) < 0)
+            perror("pidfd_open");
+    }
+    return wp;
+}
+
+// the catch-up FULL a worker ran is over, with a report or with its exit
+void end_catchup(worker_pipe_t *wp) {
+    if (!wp->catchup) return;
+    wp->catchup = 0;
+    catchup_running--;
 }
 
 void remove_worker_pipe(pid_t pid) {
@@ -107,7 +735,14 @@ void remove_worker_pipe(pid_t pid) {
         if ((*curr)->pid == pid) {
             worker_pipe_t *tmp = *curr;
             *curr = tmp->next;
-            close(tmp->fd);
+            end_catchup(tmp);
+            if (tmp->fd >= 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, tmp->fd, NULL);
+                close(tmp->fd);
+            }
+            if (tmp->pidfd >= 0) close(tmp->pidfd);
+            if (tmp->cmd_fd >= 0) close(tmp->cmd_fd);
+            free(tmp->frame);
             free(tmp);
             return;
         }
@@ -115,129 +750,1846 @@ void remove_worker_pipe(pid_t pid) {
     }
 }
 
+// --- sync_info index ---
+void index_init(index_table_t *t, unsigned capacity) {
+    t->slots = malloc(capacity * sizeof(index_slot_t));
+    for (unsigned i = 0; i < capacity; i++) t->slots[i].idx = -1;
+    t->mask = capacity - 1;
+    t->used = 0;
+}
+
+void index_insert(index_table_t *t, unsigned hash, int idx) {
+    if (!t->slots) index_init(t, 64);
+    if ((t->used + 1) * 2 > t->mask + 1) {
+        index_table_t bigger;
+        index_init(&bigger, (t->mask + 1) * 2);
+        for (unsigned i = 0; i <= t->mask; i++)
+            if (t->slots[i].idx >= 0)
+                index_insert(&bigger, t->slots[i].hash, t->slots[i].idx);
+        free(t->slots);
+        *t = bigger;
+    }
+    unsigned i = hash & t->mask;
+    while (t->slots[i].idx >= 0) i = (i + 1) & t->mask;
+    t->slots[i].hash = hash;
+    t->slots[i].idx = idx;
+    t->used++;
+}
+
+void index_remove(index_table_t *t, unsigned hash, int idx) {
+    if (!t->slots) return;
+    unsigned i = hash & t->mask;
+    while (t->slots[i].idx >= 0 && t->slots[i].idx != idx) i = (i + 1) & t->mask;
+    if (t->slots[i].idx < 0) return;
+    // shift later members of the probe run back so lookups never hit a hole
+    for (unsigned j = (i + 1) & t->mask; t->slots[j].idx >= 0; j = (j + 1) & t->mask) {
+        unsigned home = t->slots[j].hash & t->mask;
+        if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i].idx = -1;
+    t->used--;
+}
+
 // --- sync_info helpers ---
-void add_sync_info(const char *source, const char *target) {
-    sync_info_t *node = malloc(sizeof(sync_info_t));
-    strncpy(node->source_dir, source, sizeof(node->source_dir));
-    strncpy(node->target_dir, target, sizeof(node->target_dir));
+// give a pair one more target; returns 1 if added, 0 if it already had it,
+// -1 if the pair cannot take it (too many targets or too long a name)
+int add_sync_target(int idx, const char *target) {
+    sync_info_t *si = &sync_table[idx];
+    for (int k = 0; k < si->target_count; k++)
+        if (!strcmp(si->targets[k].dir, target)) return 0;
+    size_t len = strlen(target), used = si->target_dir ? strlen(si->target_dir) : 0;
+    if (si->target_count == MAX_TARGETS || len >= sizeof(si->targets[0].dir) || used + len + 2 > TARGETS_LEN)
+        return -1;
+    si->targets = realloc(si->targets, (si->target_count + 1) * sizeof(sync_target_t));
+    sync_target_t *t = &si->targets[si->target_count++];
+    strcpy(t->dir, target);
+    strcpy(t->last_result, "NONE");
+    t->error_count = 0;
+    si->target_dir = realloc(si->target_dir, used + len + 2);
+    if (used) si->target_dir[used++] = TARGET_SEP;
+    strcpy(si->target_dir + used, target);
+    return 1;
+}
+
+// returns the new pair's index, -1 if the source or target name is too long
+int add_sync_info(const char *source, const char *target) {
+    if (strlen(source) >= sizeof(sync_table->source_dir) || strlen(target) >= sizeof(sync_table->targets->dir))
+        return -1;
+    if (sync_count == sync_capacity) {
+        sync_capacity = sync_capacity ? sync_capacity * 2 : 16;
+        sync_table = realloc(sync_table, sync_capacity * sizeof(sync_info_t));
+    }
+    int idx = sync_count++;
+    sync_info_t *node = &sync_table[idx];
+    snprintf(node->source_dir, sizeof(node->source_dir), "%s", source);
+    node->target_dir = NULL;
+    node->targets = NULL;
+    node->target_count = 0;
+    add_sync_target(idx, target);
     node->active = 1;
     strcpy(node->last_result, "NONE");
     strcpy(node->last_sync_time, "Never");
     node->error_count = 0;
     node->inotify_watch = -1;
-    node->next = sync_info_head;
-    sync_info_head = node;
+    node->watch_shard = 0;
+    node->pending = 0;
+    node->dirty = 0;
+    memset(node->queue, 0, sizeof(node->queue));
+    memset(node->credit, 0, sizeof(node->credit));
+    node->queued = 0;
+    node->ready = 0;
+    memset(&node->stats, 0, sizeof(node->stats));
+    node->token_mtime = node->token_ctime = 0;
+    node->catchup = 0;
+    index_insert(&source_index, hash_str(node->source_dir), idx);
+    return idx;
+}
+
+int find_sync_index(const char *source) {
+    if (!source_index.slots) return -1;
+    unsigned h = hash_str(source);
+    for (unsigned i = h & source_index.mask; source_index.slots[i].idx >= 0; i = (i + 1) & source_index.mask) {
+        index_slot_t *slot = &source_index.slots[i];
+        if (slot->hash == h && strcmp(sync_table[slot->idx].source_dir, source) == 0)
+            return slot->idx;
+    }
+    return -1;
 }
 
 sync_info_t *find_sync_info(const char *source) {
-    for (sync_info_t *cur = sync_info_head; cur; cur = cur->next)
-        if (strcmp(cur->source_dir, source) == 0)
-            return cur;
-    return NULL;
+    int idx = find_sync_index(source);
+    return idx < 0 ? NULL : &sync_table[idx];
+}
+
+// watch descriptors are only unique within one inotify instance
+unsigned hash_watch(int shard, int wd) {
+    return hash_int(wd) * 31u + shard;
+}
+
+int find_sync_index_by_watch(int shard, int wd) {
+    if (!watch_index.slots) return -1;
+    unsigned h = hash_watch(shard, wd);
+    for (unsigned i = h & watch_index.mask; watch_index.slots[i].idx >= 0; i = (i + 1) & watch_index.mask) {
+        index_slot_t *slot = &watch_index.slots[i];
+        if (slot->hash == h && sync_table[slot->idx].inotify_watch == wd
+            && sync_table[slot->idx].watch_shard == shard)
+            return slot->idx;
+    }
+    return -1;
+}
+
+// one line per target, in the same wording as the console, so fss_report
+// can read either log
+void log_added(const sync_info_t *si, const char *target) {
+    char msg[600];
+    snprintf(msg, sizeof(msg), "Added directory: %s -> %s", si->source_dir, target);
+    log_message(msg);
+}
+
+// start inotify monitoring for sync_table[idx]; sources are spread over the
+// shards so an overflow only costs a rescan of the sources sharing its queue
+void watch_sync_info(int idx) {
+    sync_info_t *si = &sync_table[idx];
+    si->watch_shard = idx % inotify_shards;
+    int wd = inotify_add_watch(inotify_fds[si->watch_shard], si->source_dir, WATCH_MASK);
+    if (wd < 0) { perror("inotify_add_watch"); return; }
+    si->inotify_watch = wd;
+    index_insert(&watch_index, hash_watch(si->watch_shard, wd), idx);
+    for (int k = 0; k < si->target_count; k++) log_added(si, si->targets[k].dir);
 }
 
 void remove_sync_info(const char *source) {
     sync_info_t *si = find_sync_info(source);
     if (si) {
         si->active = 0;
-        if (inotify_fd >= 0 && si->inotify_watch >= 0) {
-            inotify_rm_watch(inotify_fd, si->inotify_watch);
+        if (inotify_fds && si->inotify_watch >= 0) {
+            index_remove(&watch_index, hash_watch(si->watch_shard, si->inotify_watch), si - sync_table);
+            inotify_rm_watch(inotify_fds[si->watch_shard], si->inotify_watch);
             si->inotify_watch = -1;
         }
+        char msg[320];
+        snprintf(msg, sizeof(msg), "Monitoring stopped for %s", si->source_dir);
+        log_message(msg);
     }
 }
 
-void update_sync_info(const char *source, const char *exec_report) {
+// a task for the targets listed in targets ended with status; records, when
+// the worker sent them, hold each target's own outcome in the same order
+void update_sync_info(const char *source, const char *targets, int status,
+                      const report_target_t *records, int nrecords) {
     sync_info_t *info = find_sync_info(source);
     if (!info) return;
     char buf[32];
     time_t now = time(NULL);
     struct tm *tm = localtime(&now);
     strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm);
-    strncpy(info->last_sync_time, buf, sizeof(info->last_sync_time));
-    char *st = strstr(exec_report, "STATUS:");
-    if (st) {
-        char status_str[16];
-        sscanf(st, "STATUS: %15s", status_str);
-        strncpy(info->last_result, status_str, sizeof(info->last_result));
-        if (strcmp(status_str, "ERROR") == 0 || strcmp(status_str, "PARTIAL") == 0)
-            info->error_count++;
+    snprintf(info->last_sync_time, sizeof(info->last_sync_time), "%s", buf);
+    snprintf(info->last_result, sizeof(info->last_result), "%s", status_name(status));
+    if (status != STATUS_SUCCESS)
+        info->error_count++;
+    const char *p = targets;
+    for (int i = 0; *p; i++) {
+        size_t len = strcspn(p, (char[]){ TARGET_SEP, '\0' });
+        int st = i < nrecords ? records[i].status : status;
+        for (int k = 0; k < info->target_count; k++) {
+            sync_target_t *t = &info->targets[k];
+            if (strlen(t->dir) != len || strncmp(t->dir, p, len)) continue;
+            snprintf(t->last_result, sizeof(t->last_result), "%s", status_name(st));
+            if (st != STATUS_SUCCESS) t->error_count++;
+        }
+        p += len + (p[len] != '\0');
     }
 }
 
+void record_latency(int idx, int stage, long long ns) {
+    sync_stats_t *st = &sync_table[idx].stats;
+    if (!st->latency) st->latency = calloc(LAT_STAGES, sizeof(latency_hist_t));
+    if (st->latency) hist_record(&st->latency[stage], ns);
+    hist_record(&total_stats.latency[stage], ns);
+}
+
+// a task or batch of source went to wp; starts the clocks its report stops
+void note_dispatch(worker_pipe_t *wp, const char *source, long long event_ns) {
+    long long now = now_ns();
+    wp->dispatched_ns = now;
+    wp->event_ns = event_ns;
+    int idx = find_sync_index(source);
+    if (idx < 0) return;
+    sync_table[idx].stats.dispatches++;
+    total_stats.dispatches++;
+    if (event_ns) record_latency(idx, LAT_QUEUED, now - event_ns);
+}
+
+void note_report(const worker_pipe_t *wp, const report_frame_t *f) {
+    int idx = find_sync_index(wp->source);
+    if (idx < 0) return;
+    long long now = now_ns();
+    sync_stats_t *stats[2] = { &sync_table[idx].stats, &total_stats };
+    for (int i = 0; i < 2; i++) {
+        stats[i]->files_done += f->files_done;
+        stats[i]->files_unchanged += f->files_unchanged;
+        stats[i]->files_failed += f->files_failed;
+        stats[i]->bytes_written += f->bytes_written;
+        stats[i]->fsyncs += f->fsyncs;
+        stats[i]->fsync_ns += f->fsync_ns;
+    }
+    record_latency(idx, LAT_RUN, now - wp->dispatched_ns);
+    if (wp->event_ns) record_latency(idx, LAT_SYNCED, now - wp->event_ns);
+}
+
+// --- inotify event coalescing ---
+// events for the same (source, filename) are merged while they keep arriving
+// within debounce_ms of each other; the merged task is dispatched once quiet.
+// Without -d, events are still merged within one drain of the inotify queue
+typedef struct pending_event {
+    int si;                    // sync_table index
+    uint32_t name;             // interned filename, handed on to the task
+    const char *operation;     // ADDED / MODIFIED / DELETED after merging
+    long long first_ns;
+    long long last_ns;
+    struct pending_event *hnext;
+    struct pending_event *prev, *next;
+} pending_event_t;
+static pending_event_t *pending_index[HASH_BUCKETS];
+static pending_event_t *pending_head = NULL, *pending_tail = NULL;  // ordered by last_ns
+static int debounce_ms = 0;
+
+// pending events come from slabs like tasks do
+#define PENDING_SLAB 1024
+static pending_event_t *free_pending = NULL;
+
+pending_event_t *alloc_pending(void) {
+    if (!free_pending) {
+        pending_event_t *slab = malloc(PENDING_SLAB * sizeof(pending_event_t));
+        if (!slab) return NULL;
+        for (int i = 0; i < PENDING_SLAB; i++) {
+            slab[i].next = free_pending;
+            free_pending = &slab[i];
+        }
+    }
+    pending_event_t *pe = free_pending;
+    free_pending = pe->next;
+    return pe;
+}
+
+void free_pending_event(pending_event_t *pe) {
+    release_name(pe->name);
+    pe->next = free_pending;
+    free_pending = pe;
+}
+
+unsigned pending_bucket(int si, uint32_t name) {
+    return (hash_int(si) * 31u + hash_int(name)) % HASH_BUCKETS;
+}
+
+// CREATE+MODIFY*N stays ADDED, anything followed by DELETE is DELETED; a
+// file moved in counts as created, one moved out as deleted
+const char *merge_operation(const char *pending, uint32_t mask) {
+    if (mask & (IN_DELETE | IN_MOVED_FROM)) return "DELETED";
+    if (mask & (IN_CREATE | IN_MOVED_TO)) return "ADDED";
+    if (pending && !strcmp(pending, "ADDED")) return "ADDED";
+    return "MODIFIED";
+}
+
+void pending_unlink(pending_event_t *pe) {
+    if (pe->prev) pe->prev->next = pe->next; else pending_head = pe->next;
+    if (pe->next) pe->next->prev = pe->prev; else pending_tail = pe->prev;
+    pe->prev = pe->next = NULL;
+}
+
+void pending_append(pending_event_t *pe) {
+    pe->prev = pending_tail;
+    pe->next = NULL;
+    if (pending_tail) pending_tail->next = pe; else pending_head = pe;
+    pending_tail = pe;
+}
+
+void pending_remove(pending_event_t *pe) {
+    sync_info_t *si = &sync_table[pe->si];
+    pending_event_t **curr = &pending_index[pending_bucket(pe->si, pe->name)];
+    while (*curr && *curr != pe) curr = &((*curr)->hnext);
+    if (*curr) *curr = pe->hnext;
+    pending_unlink(pe);
+    si->pending--;
+}
+
+void pending_dispatch(pending_event_t *pe) {
+    sync_info_t *si = &sync_table[pe->si];
+    pending_remove(pe);
+    if (si->active)
+        spawn_worker(si->source_dir, si->target_dir, name_str(pe->name), pe->operation, pe->first_ns);
+    free_pending_event(pe);
+}
+
+// forget every pending event of one source; returns the oldest one's time
+long long drop_pending(int idx) {
+    long long first_ns = 0;
+    pending_event_t *pe = pending_head;
+    while (pe && sync_table[idx].pending > 0) {
+        pending_event_t *next = pe->next;
+        if (pe->si == idx) {
+            if (!first_ns || pe->first_ns < first_ns) first_ns = pe->first_ns;
+            pending_remove(pe);
+            free_pending_event(pe);
+        }
+        pe = next;
+    }
+    return first_ns;
+}
+
+// tasks reach workers as tab-separated lines, so a file whose name holds a tab
+// or newline is not queued but logged, with those characters shown as '?'
+int unsendable_name(const char *source, const char *filename) {
+    if (!strpbrk(filename, "\t\n")) return 0;
+    char shown[MAX_LINE], msg[MAX_LINE + 300];
+    snprintf(shown, sizeof(shown), "%s", filename);
+    for (char *p = shown; (p = strpbrk(p, "\t\n")); ) *p = '?';
+    snprintf(msg, sizeof(msg), "Not syncing %s/%s: tab or newline in the file name.", source, shown);
+    log_message(msg);
+    return 1;
+}
+
+void coalesce_event(int si, const char *filename, uint32_t mask) {
+    if (!(mask & WATCH_MASK)) return;
+    // a worker's file in progress; its rename into place is the event
+    if (!strncmp(filename, TMP_PREFIX, strlen(TMP_PREFIX))) return;
+    if (unsendable_name(sync_table[si].source_dir, filename)) return;
+    sync_table[si].stats.events++;
+    total_stats.events++;
+    if (sync_table[si].dirty) {
+        sync_table[si].stats.events_dropped++;
+        total_stats.events_dropped++;
+        return;
+    }
+    long long now = now_ns();
+    // interned names compare by offset; the reference is kept only by a new event
+    uint32_t name = intern_name(filename);
+    unsigned b = pending_bucket(si, name);
+    pending_event_t *pe;
+    for (pe = pending_index[b]; pe; pe = pe->hnext)
+        if (pe->si == si && pe->name == name)
+            break;
+    if (pe) {
+        release_name(name);
+        sync_table[si].stats.events_coalesced++;
+        total_stats.events_coalesced++;
+        pe->operation = merge_operation(pe->operation, mask);
+        pe->last_ns = now;
+        // a file written continuously is still synced at least every 10 windows
+        if (debounce_ms > 0 && now - pe->first_ns >= 10LL * debounce_ms * 1000000LL) {
+            pending_dispatch(pe);
+            return;
+        }
+        pending_unlink(pe);
+        pending_append(pe);
+        return;
+    }
+    // a new file past the backlog threshold turns the source dirty instead
+    if (sync_table[si].pending + sync_table[si].queued >= max_queued) {
+        char why[64];
+        snprintf(why, sizeof(why), "backlog over %d tasks", max_queued);
+        release_name(name);
+        mark_dirty(si, why);
+        sync_table[si].stats.events_dropped++;
+        total_stats.events_dropped++;
+        return;
+    }
+    pe = alloc_pending();
+    if (!pe) {
+        release_name(name);
+        return;
+    }
+    pe->si = si;
+    sync_table[si].pending++;
+    pe->name = name;
+    pe->operation = merge_operation(NULL, mask);
+    pe->first_ns = pe->last_ns = now;
+    pe->hnext = pending_index[b];
+    pending_index[b] = pe;
+    pending_append(pe);
+}
+
+// dispatch every pending event that has been quiet for debounce_ms
+void flush_pending_events(void) {
+    long long now = now_ns();
+    while (pending_head && now - pending_head->last_ns >= debounce_ms * 1000000LL)
+        pending_dispatch(pending_head);
+}
+
+// epoll_wait() timeout until the oldest pending event is due, -1 when none is pending
+int pending_timeout_ms(void) {
+    if (!pending_head) return -1;
+    long long wait = pending_head->last_ns + debounce_ms * 1000000LL - now_ns();
+    if (wait <= 0) return 0;
+    return (int)((wait + 999999) / 1000000);
+}
+
 // --- logging & utilities ---
+// the timestamp changes once a second, so it is only formatted then
 void current_time_str(char *buffer, size_t size) {
+    static time_t cached_sec = -1;
+    static char cached[32];
     time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
-    strftime(buffer, size, "[%Y-%m-%d %H:%M:%S]", tm);
+    if (now != cached_sec) {
+        struct tm tm;
+        localtime_r(&now, &tm);
+        strftime(cached, sizeof(cached), "[%Y-%m-%d %H:%M:%S]", &tm);
+        cached_sec = now;
+    }
+    snprintf(buffer, size, "%s", cached);
+}
+
+// log lines go into a single-producer single-consumer byte ring: the event
+// loop appends whole lines and a flusher thread writes them to stdout and the
+// log file in batches. The flusher runs at least every log_flush_ms, and
+// sooner once log_flush_records lines are waiting or the ring is half full;
+// with log_flush_ms 0 every line is written out at once.
+// A full ring makes log_message() wait for the flusher, or with -B drop the
+// line and report how many were dropped once there is room again.
+#define LOG_RING (1 << 20)            // power of two
+static char log_ring[LOG_RING];
+static atomic_size_t log_head, log_tail;   // byte counters, written by producer / flusher
+static int log_flush_ms = 100;        // -L
+static int log_flush_records = 0;     // -N, 0 = by time only
+static int log_drop_when_full = 0;    // -B
+static int log_unsignalled = 0;       // lines appended since the flusher was last woken
+static long log_dropped = 0;
+static int log_wake_fd = -1;          // eventfd the flusher sleeps on
+static atomic_int log_stopping;
+static pthread_t log_thread;
+static int log_started = 0;
+
+void log_wake(void) {
+    uint64_t one = 1;
+    if (write(log_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("write eventfd");
+    log_unsignalled = 0;
+}
+
+// write out everything appended so far; the ring wraps at most once
+void log_flush(void) {
+    size_t tail = atomic_load_explicit(&log_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&log_head, memory_order_acquire);
+    if (head == tail) return;
+    size_t off = tail & (LOG_RING - 1), len = head - tail;
+    size_t first = len < LOG_RING - off ? len : LOG_RING - off;
+    struct iovec iov[2] = { { log_ring + off, first }, { log_ring, len - first } };
+    int fds[2] = { STDOUT_FILENO, log_fd };
+    for (int i = 0; i < 2; i++) {
+        struct iovec v[2] = { iov[0], iov[1] };
+        int cnt = v[1].iov_len ? 2 : 1, k = 0;
+        while (k < cnt) {
+            ssize_t n = writev(fds[i], v + k, cnt - k);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) break;   // a closed stdout must not stall the log file
+            while (k < cnt && (size_t)n >= v[k].iov_len) n -= v[k++].iov_len;
+            if (k < cnt) {
+                v[k].iov_base = (char *)v[k].iov_base + n;
+                v[k].iov_len -= n;
+            }
+        }
+    }
+    atomic_store_explicit(&log_tail, head, memory_order_release);
+}
+
+void *log_flusher(void *arg) {
+    (void)arg;
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+    struct pollfd pfd = { .fd = log_wake_fd, .events = POLLIN };
+    uint64_t count;
+    while (!atomic_load(&log_stopping)) {
+        if (poll(&pfd, 1, log_flush_ms > 0 ? log_flush_ms : -1) > 0)
+            while (read(log_wake_fd, &count, sizeof(count)) > 0);
+        log_flush();
+    }
+    log_flush();
+    return NULL;
+}
+
+void stop_logging(void) {
+    if (!log_started) return;
+    log_started = 0;
+    atomic_store(&log_stopping, 1);
+    log_wake();
+    pthread_join(log_thread, NULL);
+    close(log_wake_fd);
+    close(log_fd);
+}
+
+int start_logging(const char *path) {
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) return -1;
+    log_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (log_wake_fd < 0) return -1;
+    if (pthread_create(&log_thread, NULL, log_flusher, NULL)) return -1;
+    log_started = 1;
+    atexit(stop_logging);
+    return 0;
+}
+
+// copy len bytes into the ring at byte counter pos
+void log_put(size_t pos, const char *data, size_t len) {
+    size_t off = pos & (LOG_RING - 1);
+    size_t first = len < LOG_RING - off ? len : LOG_RING - off;
+    memcpy(log_ring + off, data, first);
+    memcpy(log_ring, data + first, len - first);
+}
+
+// append one line; returns 0 if it was dropped
+int log_append(const char *line, size_t len) {
+    size_t head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    while (LOG_RING - (head - atomic_load_explicit(&log_tail, memory_order_acquire)) < len) {
+        if (log_drop_when_full) return 0;
+        log_wake();
+        usleep(100);
+    }
+    log_put(head, line, len);
+    atomic_store_explicit(&log_head, head + len, memory_order_release);
+    log_unsignalled++;
+    size_t used = head + len - atomic_load_explicit(&log_tail, memory_order_relaxed);
+    if (!log_flush_ms || (log_flush_records && log_unsignalled >= log_flush_records) || used >= LOG_RING / 2)
+        log_wake();
+    return 1;
 }
 
 void log_message(const char *message) {
-    char tbuf[32];
+    char tbuf[32], line[8192];
     current_time_str(tbuf, sizeof(tbuf));
-    fprintf(stdout, "%s %s\n", tbuf, message);
-    if (log_fp) {
-        fprintf(log_fp, "%s %s\n", tbuf, message);
-        fflush(log_fp);
+    if (!log_started) {
+        printf("%s %s\n", tbuf, message);
+        return;
+    }
+    if (log_dropped) {
+        int n = snprintf(line, sizeof(line), "%s %ld log messages dropped (log ring full).\n", tbuf, log_dropped);
+        if (!log_append(line, n)) {
+            log_dropped++;
+            return;
+        }
+        log_dropped = 0;
+    }
+    char *out = line;
+    size_t n = snprintf(line, sizeof(line), "%s %s\n", tbuf, message);
+    if (n >= sizeof(line)) {
+        out = malloc(n + 1);
+        snprintf(out, n + 1, "%s %s\n", tbuf, message);
+        if (n > LOG_RING / 2) {
+            // cut, keeping the line ending
+            n = LOG_RING / 2;
+            out[n - 1] = '\n';
+        }
+    }
+    if (!log_append(out, n)) log_dropped++;
+    if (out != line) free(out);
+}
+
+// --- control clients ---
+// a client is either the fss_in/fss_out pair (the console shim) or one
+// connection on the control socket. Input is split into commands on newlines;
+// output goes to a ring per client, written as the client's fd takes it and
+// resumed on EPOLLOUT, so a slow client neither stalls the loop nor loses
+// replies. While a framed request ("#<id> command") is answered each line
+// goes out as "=<id> line" so a pipelining client can match replies
+#define CLIENT_OUT_MAX  (16 << 20)
+#define FIFO_RETRY_MS   200
+typedef struct client {
+    int in_fd, out_fd;         // one socket, or fss_in and fss_out (-1 while no console reads it)
+    int subscribed;            // gets worker reports and other lines no request asked for
+    int closing;               // 1 = input ended, free once drained; 2 = free now
+    char in[4096];
+    size_t in_len;
+    char *out;                 // ring of out_cap bytes; out_len queued from out_head
+    size_t out_cap, out_head, out_len;
+    struct client *next;
+} client_t;
+static client_t fifo_client = { .in_fd = -1, .out_fd = -1, .subscribed = 1 };
+static client_t *clients = &fifo_client;
+static client_t *current_client = NULL;   // whose command is running
+static long request_id = -1;              // its framed request, -1 = none
+static char *control_path = "fss.sock";   // -S
+
+void ring_put(client_t *c, const char *data, size_t len) {
+    if (!len) return;
+    if (c->out_len + len > CLIENT_OUT_MAX) {
+        // the console FIFO loses the excess as before; a socket client that
+        // stopped reading is cut off rather than buffered without bound
+        if (c != &fifo_client && !c->closing) {
+            log_message("Control client stopped reading; disconnected.");
+            c->closing = 2;
+        }
+        return;
+    }
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + len) cap *= 2;
+        char *ring = malloc(cap);
+        if (c->out_len) {
+            size_t first = c->out_cap - c->out_head < c->out_len ? c->out_cap - c->out_head : c->out_len;
+            memcpy(ring, c->out + c->out_head, first);
+            memcpy(ring + first, c->out, c->out_len - first);
+        }
+        free(c->out);
+        c->out = ring;
+        c->out_cap = cap;
+        c->out_head = 0;
+    }
+    size_t tail = (c->out_head + c->out_len) % c->out_cap;
+    size_t first = c->out_cap - tail < len ? c->out_cap - tail : len;
+    memcpy(c->out + tail, data, first);
+    memcpy(c->out, data + first, len - first);
+    c->out_len += len;
+}
+
+void flush_client(client_t *c) {
+    while (c->out_len && c->out_fd >= 0 && c->closing < 2) {
+        size_t seg = c->out_cap - c->out_head < c->out_len ? c->out_cap - c->out_head : c->out_len;
+        ssize_t n = write(c->out_fd, c->out + c->out_head, seg);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n < 0) {
+            // the reader is gone: the console FIFO waits for the next one
+            if (c == &fifo_client) {
+                close(c->out_fd);
+                c->out_fd = -1;
+                c->out_len = c->out_head = 0;
+            } else c->closing = 2;
+            return;
+        }
+        c->out_head = (c->out_head + n) % c->out_cap;
+        c->out_len -= n;
+    }
+    if (!c->out_len) c->out_head = 0;
+}
+
+void client_put(client_t *c, const char *text, size_t len) {
+    if (request_id < 0 || c != current_client) ring_put(c, text, len);
+    else {
+        char tag[32];
+        int tag_len = snprintf(tag, sizeof(tag), "=%ld ", request_id);
+        while (len) {
+            const char *nl = memchr(text, '\n', len);
+            size_t line = nl ? (size_t)(nl - text) : len;
+            ring_put(c, tag, tag_len);
+            ring_put(c, text, line);
+            ring_put(c, "\n", 1);
+            if (nl) line++;
+            text += line;
+            len -= line;
+        }
+    }
+    flush_client(c);
+}
+
+// output of a command goes to the client that sent it; anything else (worker
+// reports, tasks dispatched later) to every subscribed client that can read
+void console_write(const char *text, size_t len) {
+    if (current_client) {
+        client_put(current_client, text, len);
+        return;
+    }
+    for (client_t *c = clients; c; c = c->next)
+        if (c->subscribed && c->out_fd >= 0 && !c->closing)
+            client_put(c, text, len);
+}
+
+client_t *find_client(void *ptr) {
+    for (client_t *c = clients; c; c = c->next)
+        if (c == ptr) return c;
+    return NULL;
+}
+
+// free clients whose connection ended; the console shim is never freed
+void sweep_clients(void) {
+    client_t **pc = &clients;
+    while (*pc) {
+        client_t *c = *pc;
+        if (c == &fifo_client || !(c->closing == 2 || (c->closing == 1 && !c->out_len))) {
+            pc = &c->next;
+            continue;
+        }
+        *pc = c->next;
+        close(c->in_fd);
+        free(c->out);
+        free(c);
+    }
+}
+
+void accept_clients(void) {
+    int fd;
+    while ((fd = accept4(control_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        client_t *c = calloc(1, sizeof(client_t));
+        c->in_fd = c->out_fd = fd;
+        c->next = clients;
+        clients = c;
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl client");
+            c->closing = 2;
+        }
+    }
+}
+
+// at exit the last replies get up to a second to reach clients still reading
+void drain_clients(void) {
+    for (long long until = now_ns() + 1000000000LL; now_ns() < until; ) {
+        struct pollfd pfd[64];
+        client_t *who[64];
+        int n = 0;
+        for (client_t *c = clients; c && n < 64; c = c->next)
+            if (c->out_len && c->out_fd >= 0 && c->closing < 2) {
+                pfd[n] = (struct pollfd){ .fd = c->out_fd, .events = POLLOUT };
+                who[n++] = c;
+            }
+        if (!n) break;
+        if (poll(pfd, n, 100) > 0)
+            for (int i = 0; i < n; i++)
+                if (pfd[i].revents) flush_client(who[i]);
+    }
+}
+
+int open_control_socket(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = &control_fd };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0
+        || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// fss_out has a reader only while a console runs; instead of waiting for one
+// the loop retries every FIFO_RETRY_MS and replies queue in the meantime
+void open_fifo_out(void) {
+    int fd = open("fss_out", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return;
+    struct epoll_event ev = { .events = EPOLLOUT | EPOLLET, .data.ptr = &fifo_client };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl fss_out");
+        close(fd);
+        return;
     }
+    fifo_client.out_fd = fd;
+    flush_client(&fifo_client);
 }
 
 void cleanup_resources() {
     unlink("fss_in");
     unlink("fss_out");
+    unlink(control_path);
 }
 
 int worker_limit = 5;
-int current_worker_count = 0;
+int current_worker_count = 0;      // tasks in flight
+static int worker_pool_mode = 0;   // -p: keep worker_limit long-lived workers
+static char *full_threads = NULL;  // -j: threads each worker uses for a FULL sync or VERIFY, else one per CPU
+static int worker_uring = 0;       // -u: workers batch small-file copies through io_uring
+static char *fsync_policy = NULL;  // -F: passed to workers as is
+static int delta_in_place = 0;     // -P: workers may patch unclonable targets in place
 
-void spawn_worker(const char *source, const char *target, const char *filename, const char *operation) {
-    if (current_worker_count >= worker_limit) {
-        char msg[256];
-        snprintf(msg, sizeof(msg), "Max worker limit reached. Task queued: %s", source);
+// --- persistent worker pool ---
+// in a forked child: exec ./worker with the flags every worker shares,
+// followed by extra; never returns
+void exec_worker(char *const extra[]) {
+    char *argv[16];
+    int n = 0;
+    argv[n++] = "worker";
+    if (full_threads) {
+        argv[n++] = "-j";
+        argv[n++] = full_threads;
+    }
+    if (worker_uring) argv[n++] = "-u";
+    if (delta_in_place) argv[n++] = "-P";
+    if (fsync_policy) {
+        argv[n++] = "-F";
+        argv[n++] = fsync_policy;
+    }
+    while (*extra && n < 15) argv[n++] = *extra++;
+    argv[n] = NULL;
+    execv("./worker", argv);
+    perror("execv");
+    _exit(1);
+}
+
+// start one "./worker -p" process; tasks go down its stdin, reports come back on stdout
+worker_pipe_t *start_pool_worker(void) {
+    int cmdfd[2], repfd[2];
+    // close-on-exec so later workers do not hold each other's task channels open
+    if (pipe2(cmdfd, O_CLOEXEC) < 0) { perror("pipe"); return NULL; }
+    if (pipe2(repfd, O_CLOEXEC) < 0) { perror("pipe"); close(cmdfd[0]); close(cmdfd[1]); return NULL; }
+    pid_t pid = fork();
+    if (pid == 0) {
+        sigprocmask(SIG_UNBLOCK, &sigchld_mask, NULL);
+        close(cmdfd[1]);
+        close(repfd[0]);
+        dup2(cmdfd[0], STDIN_FILENO);
+        dup2(repfd[1], STDOUT_FILENO);
+        close(cmdfd[0]);
+        close(repfd[1]);
+        exec_worker((char *[]){ "-p", NULL });
+    }
+    close(cmdfd[0]);
+    close(repfd[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(cmdfd[1]);
+        close(repfd[0]);
+        return NULL;
+    }
+    worker_pipe_t *wp = add_worker_pipe(pid, repfd[0], "", "");
+    wp->cmd_fd = cmdfd[1];
+    wp->pooled = worker_pool_mode;
+    return wp;
+}
+
+void start_worker_pool(void) {
+    for (int i = 0; i < worker_limit; i++)
+        start_pool_worker();
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Worker pool started with %d workers.", worker_limit);
+    log_message(msg);
+}
+
+worker_pipe_t *idle_pool_worker(void) {
+    for (worker_pipe_t *wp = worker_pipes; wp; wp = wp->next)
+        if (wp->cmd_fd >= 0 && !wp->busy)
+            return wp;
+    return NULL;
+}
+
+// a one-shot worker that could not be started (pipe or fork failed) leaves its
+// task queued; no other is started until the backoff, doubled on each failure
+// in a row, has passed, so the dispatch loop waits instead of spinning
+#define SPAWN_BACKOFF_MIN_MS 100
+#define SPAWN_BACKOFF_MAX_MS 5000
+static long long spawn_retry_ns = 0;
+static int spawn_backoff_ms = 0;
+
+void spawn_failed(void) {
+    spawn_backoff_ms = spawn_backoff_ms ? spawn_backoff_ms * 2 : SPAWN_BACKOFF_MIN_MS;
+    if (spawn_backoff_ms > SPAWN_BACKOFF_MAX_MS) spawn_backoff_ms = SPAWN_BACKOFF_MAX_MS;
+    spawn_retry_ns = now_ns() + spawn_backoff_ms * 1000000LL;
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Could not start a worker; retrying in %d ms.", spawn_backoff_ms);
+    log_message(msg);
+}
+
+// epoll_wait() timeout until workers may be started again, -1 when they may
+int spawn_timeout_ms(void) {
+    long long wait = spawn_retry_ns - now_ns();
+    if (wait <= 0) return -1;
+    return (int)((wait + 999999) / 1000000);
+}
+
+int worker_available(void) {
+    if (current_worker_count >= worker_limit) return 0;
+    if (!worker_pool_mode) return now_ns() >= spawn_retry_ns;
+    return idle_pool_worker() != NULL;
+}
+
+// hand a task to an idle pool worker; returns 0 if the channel is broken
+int send_worker_text(worker_pipe_t *wp, const char *source, const char *target,
+                     const char *text, size_t len);
+
+int send_pool_task(worker_pipe_t *wp, const char *source, const char *target,
+                   const char *filename, const char *operation) {
+    char line[TARGETS_LEN + 1024];
+    int n = snprintf(line, sizeof(line), "%s\t%s\t%s\t%s\n", source, target, filename, operation);
+    if (n < 0 || n >= (int)sizeof(line)) return 0;
+    return send_worker_text(wp, source, target, line, n);
+}
+
+// write task text, one task line or a whole BATCH, down a worker's stdin. A
+// worker whose channel broke is not offered another task: its stdin is
+// closed, so it exits if it has not already, and it is replaced once reaped
+int send_worker_text(worker_pipe_t *wp, const char *source, const char *target,
+                     const char *text, size_t len) {
+    if (!wp) return 0;
+    if (write(wp->cmd_fd, text, len) != (ssize_t)len) {
+        close(wp->cmd_fd);
+        wp->cmd_fd = -1;
+        return 0;
+    }
+    wp->busy = 1;
+    snprintf(wp->source, sizeof(wp->source), "%s", source);
+    snprintf(wp->target, sizeof(wp->target), "%s", target);
+    current_worker_count++;
+    return 1;
+}
+
+// a pool worker exited: fail its in-flight task and replace it
+void pool_worker_exited(worker_pipe_t *wp) {
+    char msg[512];
+    if (wp->busy) {
+        current_worker_count--;
+        snprintf(msg, sizeof(msg), "Worker %d died while syncing %s.", wp->pid, wp->source);
         log_message(msg);
-        enqueue_task(source, target, filename, operation);
-        return;
+        update_sync_info(wp->source, wp->target, STATUS_ERROR, NULL, 0);
+    }
+    int respawn = wp->tasks_done > 0 || now_ns() - wp->spawned_ns > 1000000000LL;
+    pid_t pid = wp->pid;
+    remove_worker_pipe(pid);
+    if (respawn) {
+        worker_pipe_t *nw = start_pool_worker();
+        if (nw) {
+            snprintf(msg, sizeof(msg), "Worker %d replaced by worker %d.", pid, nw->pid);
+            log_message(msg);
+        }
+    } else {
+        snprintf(msg, sizeof(msg), "Worker %d exited at startup; not respawning.", pid);
+        log_message(msg);
+    }
+}
+
+// the file counts that open a report's details
+int format_counts(char *out, size_t size, int operation, unsigned done, unsigned unchanged, unsigned failed) {
+    if (operation == OP_DELETED)
+        return snprintf(out, size, "%u files deleted, %u failed", done, failed);
+    if (operation == OP_BATCH)
+        return snprintf(out, size, "%u files synced, %u unchanged, %u failed", done, unchanged, failed);
+    if (operation == OP_FULL)
+        return snprintf(out, size, "%u files copied, %u unchanged, %u failed", done, unchanged, failed);
+    if (operation == OP_VERIFY)
+        return snprintf(out, size, "%u files match, %u differ or failed", done, failed);
+    return snprintf(out, size, "%u files copied, %u failed", done, failed);
+}
+
+// "[src] [tgt] [pid] [OP] [STATUS] [details]" followed by the error lines;
+// reports only become text here, for the log and the console. A task for
+// several targets gets one such line per target, with that target's status
+// and counts, so the log keeps reading as one line per pair
+int render_report(const worker_pipe_t *wp, const report_frame_t *f,
+                  const char *errors, size_t errors_len,
+                  const char *results, size_t results_len,
+                  const report_target_t *records, int nrecords, char *out, size_t size) {
+    char details[256];
+    int n = 0;
+    for (int m = 0; m < COPY_METHODS; m++)
+        if (f->copied_by[m] && n < (int)sizeof(details))
+            n += snprintf(details + n, sizeof(details) - n, ", %s=%u", copy_method_names[m], f->copied_by[m]);
+    if (f->operation == OP_VERIFY && n < (int)sizeof(details))
+        n += snprintf(details + n, sizeof(details) - n, ", %llu bytes hashed",
+                      (unsigned long long)f->bytes_read);
+    else if (n < (int)sizeof(details))
+        n += snprintf(details + n, sizeof(details) - n, ", %llu bytes written, %llu skipped",
+                      (unsigned long long)f->bytes_written, (unsigned long long)f->bytes_skipped);
+    if (f->threads > 1 && n < (int)sizeof(details))
+        n += snprintf(details + n, sizeof(details) - n, ", %u threads", f->threads);
+    if (f->fsyncs && n < (int)sizeof(details))
+        n += snprintf(details + n, sizeof(details) - n, ", %u fsyncs in %.3f ms",
+                      f->fsyncs, f->fsync_ns / 1e6);
+    if (n < (int)sizeof(details))
+        snprintf(details + n, sizeof(details) - n, ", %llu ms",
+                 (unsigned long long)(f->duration_ns / 1000000));
+    int len = 0;
+    const char *target = wp->target;
+    for (int i = 0; i == 0 || (i < nrecords && *target); i++) {
+        char counts[128];
+        size_t tlen = nrecords ? strcspn(target, (char[]){ TARGET_SEP, '\0' }) : strlen(target);
+        unsigned status = nrecords ? records[i].status : f->status;
+        if (nrecords)
+            format_counts(counts, sizeof(counts), f->operation, records[i].files_done,
+                          records[i].files_unchanged, records[i].files_failed);
+        else
+            format_counts(counts, sizeof(counts), f->operation, f->files_done,
+                          f->files_unchanged, f->files_failed);
+        int k = snprintf(out + len, size - len, "%s[%s] [%.*s] [%d] [%s] [%s] [%s%s]", i ? "\n" : "",
+                         wp->source, (int)tlen, target, wp->pid, op_name(f->operation),
+                         status_name(status), counts, details);
+        if (k < 0 || (size_t)k >= size - len) return len ? len : (int)size - 1;
+        len += k;
+        target += tlen + (target[tlen] != '\0');
+    }
+    // drop the final newline; log_message adds its own
+    if (errors_len && errors[errors_len - 1] == '\n') errors_len--;
+    if (errors_len && (size_t)len + 1 + errors_len < size) {
+        out[len++] = '\n';
+        memcpy(out + len, errors, errors_len);
+        len += errors_len;
+        out[len] = '\0';
+    }
+    // one line per file of a BATCH, or per file a VERIFY found different
+    report_file_t rf;
+    for (size_t off = 0; off + sizeof(rf) <= results_len; off += sizeof(rf) + rf.name_len) {
+        memcpy(&rf, results + off, sizeof(rf));
+        if (rf.name_len > results_len - off - sizeof(rf)) break;
+        int k = snprintf(out + len, size - len, "\n- %s %.*s: %s", op_name(rf.operation),
+                         (int)rf.name_len, results + off + sizeof(rf), status_name(rf.status));
+        if (k < 0 || (size_t)k >= size - len) {
+            out[len] = '\0';
+            break;
+        }
+        len += k;
+    }
+    return len;
+}
+
+// "verify <source> repair": each file the worker listed becomes an ordinary
+// task, so the repair copies only what differs and goes through the queue
+void queue_repairs(const worker_pipe_t *wp, const char *results, size_t results_len) {
+    if (!wp->repair) return;
+    int queued = 0;
+    report_file_t rf;
+    char name[MAX_LINE], msg[512];
+    for (size_t off = 0; off + sizeof(rf) <= results_len; off += sizeof(rf) + rf.name_len) {
+        memcpy(&rf, results + off, sizeof(rf));
+        if (rf.name_len > results_len - off - sizeof(rf)) break;
+        if (rf.name_len >= sizeof(name) || rf.operation >= OP_COUNT) continue;
+        memcpy(name, results + off + sizeof(rf), rf.name_len);
+        name[rf.name_len] = '\0';
+        if (unsendable_name(wp->source, name)) continue;
+        enqueue_task(wp->source, name, op_name(rf.operation), 0);
+        queued++;
+    }
+    snprintf(msg, sizeof(msg), "Verify of %s queued %d repairs.", wp->source, queued);
+    log_message(msg);
+}
+
+// a complete report frame arrived from a worker
+void handle_worker_report(worker_pipe_t *wp, const report_frame_t *f, const char *errors, size_t errors_len,
+                          const char *results, size_t results_len, const char *targets, size_t targets_len) {
+    report_target_t records[MAX_TARGETS];
+    int nrecords = targets_len / sizeof(report_target_t);
+    if (nrecords > MAX_TARGETS) nrecords = MAX_TARGETS;
+    memcpy(records, targets, nrecords * sizeof(report_target_t));
+    // a result line is at most 17 bytes longer than its record, records are 5+;
+    // a target's line at most its name and 400 bytes more
+    size_t size = 1024 + errors_len + 5 * results_len + nrecords * (TARGETS_LEN / MAX_TARGETS + 400);
+    char *msg = malloc(size);
+    char tbuf[32];
+    render_report(wp, f, errors, errors_len, results, results_len, records, nrecords, msg, size);
+    current_time_str(tbuf, sizeof(tbuf));
+    char *line = malloc(strlen(msg) + sizeof(tbuf) + 2);
+    // each target's line is a record of its own, timestamped; the error and
+    // file lines follow the last one
+    int lines = nrecords;
+    for (char *rec = msg, *next; rec; rec = next) {
+        next = NULL;
+        if (lines-- > 1 && (next = strchr(rec, '\n'))) *next++ = '\0';
+        log_message(rec);
+        console_write(line, sprintf(line, "%s %s\n", tbuf, rec));
+    }
+    free(line);
+    free(msg);
+    // a VERIFY copies nothing, so it leaves the sync counters and results alone
+    if (f->operation == OP_VERIFY) queue_repairs(wp, results, results_len);
+    else {
+        note_report(wp, f);
+        update_sync_info(wp->source, wp->target, f->status, records, nrecords);
+    }
+    end_catchup(wp);
+    wp->tasks_done++;
+    if (wp->pooled && wp->busy) {
+        wp->busy = 0;
+        current_worker_count--;
+    }
+}
+
+// check the head of a frame; returns its length, 0 if more bytes are needed
+// to tell, or -1 if the stream cannot be a report. Frames of an older version
+// are taken: its header is a prefix of the current one
+long frame_length(const char *buf, size_t len) {
+    report_frame_t head;
+    if (len < offsetof(report_frame_t, status)) return 0;
+    memcpy(&head, buf, offsetof(report_frame_t, status));
+    if (head.magic != REPORT_MAGIC || head.version == 0 || head.version > REPORT_VERSION) return -1;
+    if (head.header_len < offsetof(report_frame_t, status) || head.length < head.header_len
+        || head.length > REPORT_FRAME_MAX) return -1;
+    return head.length;
+}
+
+// dispatch every complete frame in the reassembly buffer; a frame may arrive
+// over several reads and one read may carry several frames
+int parse_worker_frames(worker_pipe_t *wp) {
+    size_t off = 0;
+    long flen;
+    while ((flen = frame_length(wp->frame + off, wp->frame_len - off)) > 0) {
+        if ((size_t)flen > wp->frame_len - off) break;
+        const char *p = wp->frame + off;
+        report_frame_t f;
+        memset(&f, 0, sizeof(f));
+        uint16_t hlen;
+        memcpy(&hlen, p + offsetof(report_frame_t, header_len), sizeof(hlen));
+        // an older sender's shorter header leaves the newer fields zero
+        memcpy(&f, p, hlen < sizeof(f) ? hlen : sizeof(f));
+        if (f.errors_off > flen || f.errors_len > flen - f.errors_off)
+            f.errors_off = f.errors_len = 0;
+        if (f.results_off > flen || f.results_len > flen - f.results_off)
+            f.results_off = f.results_len = 0;
+        if (f.targets_off > flen || f.targets_len > flen - f.targets_off)
+            f.targets_off = f.targets_len = 0;
+        handle_worker_report(wp, &f, p + f.errors_off, f.errors_len, p + f.results_off, f.results_len,
+                             p + f.targets_off, f.targets_len);
+        off += flen;
+    }
+    wp->frame_len -= off;
+    memmove(wp->frame, wp->frame + off, wp->frame_len);
+    if (flen < 0) return -1;
+    if (flen > 0 && (size_t)flen > wp->frame_cap) {
+        wp->frame_cap = flen;
+        wp->frame = realloc(wp->frame, wp->frame_cap);
+    }
+    return 0;
+}
+
+// read one chunk from a worker pipe and dispatch every finished report;
+// returns 1 after data, 0 once the worker closed its end, -1 when drained
+int read_worker_pipe(worker_pipe_t *wp) {
+    ssize_t r = read(wp->fd, wp->frame + wp->frame_len, wp->frame_cap - wp->frame_len);
+    if (r < 0) return errno == EINTR ? 1 : -1;
+    char msg[512];
+    if (r == 0) {
+        if (wp->frame_len > 0) {
+            snprintf(msg, sizeof(msg), "Worker %d exited in the middle of a report (%zu bytes dropped).",
+                     wp->pid, wp->frame_len);
+            log_message(msg);
+            wp->frame_len = 0;
+        }
+        return 0;
+    }
+    wp->frame_len += r;
+    if (parse_worker_frames(wp) < 0) {
+        // out of sync with the stream; the worker is replaced and its task failed
+        snprintf(msg, sizeof(msg), "Worker %d sent a corrupt report; stopping it.", wp->pid);
+        log_message(msg);
+        wp->frame_len = 0;
+        kill(wp->pid, SIGTERM);
+    }
+    return 1;
+}
+
+void announce_worker(const char *source, const char *target) {
+    char out[1024], tbuf[32];
+    current_time_str(tbuf, sizeof(tbuf));
+    for (const char *p = target; ; ) {
+        size_t len = strcspn(p, (char[]){ TARGET_SEP, '\0' });
+        snprintf(out, sizeof(out), "%s Added directory: %s -> %.*s\n", tbuf, source, (int)len, p);
+        console_write(out, strlen(out));
+        if (!p[len]) break;
+        p += len + 1;
+    }
+    snprintf(out, sizeof(out), "%s Monitoring started for %s\n", tbuf, source);
+    console_write(out, strlen(out));
+}
+
+// returns the worker running the task, NULL if it was queued or failed
+worker_pipe_t *spawn_worker(const char *source, const char *target, const char *filename, const char *operation,
+                            long long event_ns) {
+    if (!worker_available()) {
+        if (enqueue_task(source, filename, operation, event_ns) && current_worker_count >= worker_limit) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "Max worker limit reached. Task queued: %s", source);
+            log_message(msg);
+        }
+        return NULL;
+    }
+    if (worker_pool_mode) {
+        worker_pipe_t *wp = idle_pool_worker();
+        if (!send_pool_task(wp, source, target, filename, operation)) {
+            enqueue_task(source, filename, operation, event_ns);
+            return NULL;
+        }
+        note_dispatch(wp, source, event_ns);
+        wp->repair = task_scope(op_from_name(operation), filename) == SCOPE_REPAIR;
+        announce_worker(source, target);
+        return wp;
     }
     int pipefd[2];
     if (pipe(pipefd) < 0) {
         perror("pipe");
-        return;
+        enqueue_task(source, filename, operation, event_ns);
+        spawn_failed();
+        return NULL;
     }
     pid_t pid = fork();
     if (pid == 0) {
+        sigprocmask(SIG_UNBLOCK, &sigchld_mask, NULL);
         close(pipefd[0]);
         dup2(pipefd[1], STDOUT_FILENO);
         close(pipefd[1]);
-        execl("./worker", "worker", source, target, filename, operation, NULL);
-        perror("execl");
-        _exit(1);
+        exec_worker((char *[]){ "-b", (char *)source, (char *)target, (char *)filename, (char *)operation, NULL });
     } else if (pid > 0) {
         close(pipefd[1]);
         current_worker_count++;
-        add_worker_pipe(pid, pipefd[0], source);
-        char out[1024], tbuf[32];
-        current_time_str(tbuf, sizeof(tbuf));
-        snprintf(out, sizeof(out),
-            "%s Added directory: %s -> %s\n"
-            "%s Monitoring started for %s\n",
-            tbuf, source, target,
-            tbuf, source);
-        write(fifo_out_fd, out, strlen(out));
+        worker_pipe_t *wp = add_worker_pipe(pid, pipefd[0], source, target);
+        note_dispatch(wp, source, event_ns);
+        wp->repair = task_scope(op_from_name(operation), filename) == SCOPE_REPAIR;
+        spawn_backoff_ms = 0;
+        announce_worker(source, target);
+        return wp;
+    }
+    perror("fork");
+    close(pipefd[0]);
+    close(pipefd[1]);
+    enqueue_task(source, filename, operation, event_ns);
+    spawn_failed();
+    return NULL;
+}
+
+// several queued files of one source go to a single worker as a BATCH; in
+// one-shot mode a fresh "./worker -p" reads it and exits at end of input
+void spawn_batch(task_t **batch, int n) {
+    sync_info_t *si = &sync_table[batch[0]->si];
+    static char text[BATCH_MAX_BYTES + 1024];
+    size_t len = snprintf(text, sizeof(text), "BATCH\t%s\t%s\t%d\n",
+                          si->source_dir, si->target_dir, n);
+    for (int i = 0; i < n; i++)
+        len += snprintf(text + len, sizeof(text) - len, "%s\t%s\n",
+                        name_str(batch[i]->name), op_name(batch[i]->operation));
+    worker_pipe_t *wp = worker_pool_mode ? idle_pool_worker() : start_pool_worker();
+    int sent = send_worker_text(wp, si->source_dir, si->target_dir, text, len);
+    if (wp) wp->repair = 0;
+    if (wp && !worker_pool_mode) {
+        // end of input lets the worker exit after its one report
+        if (wp->cmd_fd >= 0) close(wp->cmd_fd);
+        wp->cmd_fd = -1;
+        if (!sent) {
+            // reap_workers still counts it out and logs it as died
+            snprintf(wp->source, sizeof(wp->source), "%s", si->source_dir);
+            current_worker_count++;
+        }
+    }
+    if (!sent) {
+        // the tasks still hold their names, so the strings stay valid here
+        for (int i = 0; i < n; i++)
+            enqueue_task(si->source_dir, name_str(batch[i]->name), op_name(batch[i]->operation),
+                         batch[i]->event_ns);
+        if (!worker_pool_mode) spawn_failed();
+        return;
+    }
+    if (!worker_pool_mode) spawn_backoff_ms = 0;
+    long long event_ns = 0;
+    for (int i = 0; i < n; i++)
+        if (batch[i]->event_ns && (!event_ns || batch[i]->event_ns < event_ns))
+            event_ns = batch[i]->event_ns;
+    note_dispatch(wp, si->source_dir, event_ns);
+    char msg[512];
+    snprintf(msg, sizeof(msg), "Batch of %d files handed to worker %d: %s", n, wp->pid, si->source_dir);
+    log_message(msg);
+    announce_worker(si->source_dir, si->target_dir);
+}
+
+// --- stats output ---
+void format_latency(char *out, size_t size, const latency_hist_t *h, const char *stage) {
+    snprintf(out, size, "Latency %s: %llu samples, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+             stage, (unsigned long long)h->total, hist_quantile(h, 0.5) / 1e3, hist_quantile(h, 0.9) / 1e3,
+             hist_quantile(h, 0.99) / 1e3, h->max_us / 1e3);
+}
+
+// "stats" reports every source together, "stats <source>" one of them
+void write_stats(const char *source) {
+    char out[2048], tbuf[32];
+    int n = 0;
+    const sync_stats_t *st = &total_stats;
+    int queued = 0, peak = 0;
+    current_time_str(tbuf, sizeof(tbuf));
+    if (*source) {
+        sync_info_t *si = find_sync_info(source);
+        if (!si) {
+            n = snprintf(out, sizeof(out), "%s Directory not monitored: %s\n", tbuf, source);
+            console_write(out, n);
+            return;
+        }
+        st = &si->stats;
+        queued = si->queued;
+        peak = si->stats.queued_peak;
+        n += snprintf(out + n, sizeof(out) - n, "%s Stats for %s\n", tbuf, source);
     } else {
-        perror("fork");
+        for (int i = 0; i < sync_count; i++) {
+            queued += sync_table[i].queued;
+            if (sync_table[i].stats.queued_peak > peak) peak = sync_table[i].stats.queued_peak;
+        }
+        n += snprintf(out + n, sizeof(out) - n, "%s Stats for %d directories\n"
+                      "Workers: %d busy of %d, %ld started, %d tasks dropped, %d rescans queued\n"
+                      "Inotify: %d queues, %d overflows, %zu KiB read buffer\n",
+                      tbuf, sync_count, current_worker_count, worker_limit, workers_forked,
+                      tasks_dropped, rescans_queued, inotify_shards, inotify_overflows, event_buf_len / 1024);
+    }
+    n += snprintf(out + n, sizeof(out) - n,
+                  "Events: %lld received, %lld coalesced, %lld dropped while dirty\n"
+                  "Queue: %d queued, peak %d\n"
+                  "Dispatched: %lld\n"
+                  "Files: %lld synced, %lld unchanged, %lld failed, %lld bytes written\n"
+                  "Fsync: %lld calls, %.3f ms\n",
+                  st->events, st->events_coalesced, st->events_dropped, queued, peak, st->dispatches,
+                  st->files_done, st->files_unchanged, st->files_failed, st->bytes_written,
+                  st->fsyncs, st->fsync_ns / 1e6);
+    static const latency_hist_t no_samples;
+    for (int i = 0; i < LAT_STAGES && n < (int)sizeof(out); i++) {
+        format_latency(out + n, sizeof(out) - n, st->latency ? &st->latency[i] : &no_samples, stage_names[i]);
+        n += strlen(out + n);
+    }
+    console_write(out, strlen(out));
+}
+
+// Prometheus label values escape backslash, quote and newline
+const char *prom_label(const char *in, char *out, size_t size) {
+    size_t n = 0;
+    for (; *in && n + 2 < size; in++) {
+        if (*in == '\\' || *in == '"') out[n++] = '\\';
+        if (*in == '\n') { out[n++] = '\\'; out[n++] = 'n'; continue; }
+        out[n++] = *in;
+    }
+    out[n] = '\0';
+    return out;
+}
+
+// per-source counters, exported in this order
+static const struct { const char *name, *help; size_t off; } source_counters[] = {
+    { "fss_events_total",           "inotify events received",             offsetof(sync_stats_t, events) },
+    { "fss_events_coalesced_total", "events merged into a pending task",   offsetof(sync_stats_t, events_coalesced) },
+    { "fss_events_dropped_total",   "events dropped while a rescan was queued", offsetof(sync_stats_t, events_dropped) },
+    { "fss_dispatches_total",       "tasks or batches handed to a worker", offsetof(sync_stats_t, dispatches) },
+    { "fss_files_synced_total",     "files copied or deleted",             offsetof(sync_stats_t, files_done) },
+    { "fss_files_unchanged_total",  "files a FULL sync found unchanged",   offsetof(sync_stats_t, files_unchanged) },
+    { "fss_files_failed_total",     "files that failed to sync",           offsetof(sync_stats_t, files_failed) },
+    { "fss_bytes_written_total",    "bytes written to targets",            offsetof(sync_stats_t, bytes_written) },
+    { "fss_fsyncs_total",           "fsync and syncfs calls of workers",   offsetof(sync_stats_t, fsyncs) },
+};
+
+// rewrite the -m file in the Prometheus text format; readers see either the
+// old or the new file, never a partial one
+void write_metrics_file(void) {
+    char tmp[512], label[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metrics_file);
+    FILE *f = fopen(tmp, "w");
+    if (!f) { perror("fopen metrics"); return; }
+    fprintf(f, "# HELP fss_workers_busy Workers running a task.\n# TYPE fss_workers_busy gauge\n"
+               "fss_workers_busy %d\n", current_worker_count);
+    fprintf(f, "# HELP fss_worker_limit Configured -n.\n# TYPE fss_worker_limit gauge\n"
+               "fss_worker_limit %d\n", worker_limit);
+    fprintf(f, "# HELP fss_workers_started_total Worker processes forked.\n# TYPE fss_workers_started_total counter\n"
+               "fss_workers_started_total %ld\n", workers_forked);
+    fprintf(f, "# HELP fss_tasks_dropped_total Queued tasks dropped as redundant.\n# TYPE fss_tasks_dropped_total counter\n"
+               "fss_tasks_dropped_total %d\n", tasks_dropped);
+    fprintf(f, "# HELP fss_rescans_total Sources whose backlog was replaced by a rescan.\n# TYPE fss_rescans_total counter\n"
+               "fss_rescans_total %d\n", rescans_queued);
+    fprintf(f, "# HELP fss_inotify_overflows_total Inotify queue overflows.\n# TYPE fss_inotify_overflows_total counter\n"
+               "fss_inotify_overflows_total %d\n", inotify_overflows);
+    for (size_t c = 0; c < sizeof(source_counters) / sizeof(source_counters[0]); c++) {
+        fprintf(f, "# HELP %s Per source: %s.\n# TYPE %s counter\n",
+                source_counters[c].name, source_counters[c].help, source_counters[c].name);
+        for (int i = 0; i < sync_count; i++)
+            fprintf(f, "%s{source=\"%s\"} %lld\n", source_counters[c].name,
+                    prom_label(sync_table[i].source_dir, label, sizeof(label)),
+                    *(long long *)((char *)&sync_table[i].stats + source_counters[c].off));
+    }
+    fprintf(f, "# HELP fss_fsync_seconds_total Per source: time workers spent in fsync and syncfs.\n"
+               "# TYPE fss_fsync_seconds_total counter\n");
+    for (int i = 0; i < sync_count; i++)
+        fprintf(f, "fss_fsync_seconds_total{source=\"%s\"} %.6f\n",
+                prom_label(sync_table[i].source_dir, label, sizeof(label)), sync_table[i].stats.fsync_ns / 1e9);
+    fprintf(f, "# HELP fss_queue_depth Tasks queued per source.\n# TYPE fss_queue_depth gauge\n");
+    for (int i = 0; i < sync_count; i++)
+        fprintf(f, "fss_queue_depth{source=\"%s\"} %d\n",
+                prom_label(sync_table[i].source_dir, label, sizeof(label)), sync_table[i].queued);
+    fprintf(f, "# HELP fss_queue_depth_peak Most tasks ever queued per source.\n# TYPE fss_queue_depth_peak gauge\n");
+    for (int i = 0; i < sync_count; i++)
+        fprintf(f, "fss_queue_depth_peak{source=\"%s\"} %d\n",
+                prom_label(sync_table[i].source_dir, label, sizeof(label)), sync_table[i].stats.queued_peak);
+    // quantiles only over every source together; per source the sum and
+    // count, which cost nothing to export ("stats <source>" has its quantiles)
+    fprintf(f, "# HELP fss_latency_seconds Sync latency per stage, all sources.\n# TYPE fss_latency_seconds summary\n");
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (int g = 0; g < LAT_STAGES; g++) {
+        const latency_hist_t *h = &total_stats.latency[g];
+        for (int q = 0; q < 4; q++)
+            fprintf(f, "fss_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.6f\n",
+                    stage_names[g], quantiles[q], hist_quantile(h, quantiles[q]) / 1e6);
+        fprintf(f, "fss_latency_seconds_sum{stage=\"%s\"} %.6f\n", stage_names[g], h->sum_us / 1e6);
+        fprintf(f, "fss_latency_seconds_count{stage=\"%s\"} %llu\n", stage_names[g], (unsigned long long)h->total);
+    }
+    fprintf(f, "# HELP fss_source_latency_seconds Sync latency per source and stage.\n"
+               "# TYPE fss_source_latency_seconds summary\n");
+    for (int i = 0; i < sync_count; i++) {
+        const latency_hist_t *h = sync_table[i].stats.latency;
+        if (!h) continue;
+        prom_label(sync_table[i].source_dir, label, sizeof(label));
+        for (int g = 0; g < LAT_STAGES; g++) {
+            fprintf(f, "fss_source_latency_seconds_sum{source=\"%s\",stage=\"%s\"} %.6f\n",
+                    label, stage_names[g], h[g].sum_us / 1e6);
+            fprintf(f, "fss_source_latency_seconds_count{source=\"%s\",stage=\"%s\"} %llu\n",
+                    label, stage_names[g], (unsigned long long)h[g].total);
+        }
+    }
+    if (fclose(f) != 0 || rename(tmp, metrics_file) < 0) perror("write metrics");
+}
+
+// --- state checkpoint ---
+// one line per pair: active, last result, change token, errors, last sync
+// time, source, then its targets; written like the metrics file (tmp + rename)
+#define STATE_MAGIC "FSS_STATE 3"
+
+int dir_token(const char *dir, long long *mtime, long long *ctime) {
+    struct stat st;
+    if (stat(dir, &st) < 0) return -1;
+    *mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    *ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+    return 0;
+}
+
+// a pair's token moves up to its source's current one only while nothing of
+// that source is pending, queued or running and the directory has not changed
+// for a second (so its inotify events were read long ago); a restart then
+// catches up the sources whose token moved first
+void write_state_file(void) {
+    char *busy = calloc(sync_count + 1, 1);
+    for (pending_event_t *pe = pending_head; pe; pe = pe->next) busy[pe->si] = 1;
+    for (worker_pipe_t *wp = worker_pipes; wp; wp = wp->next) {
+        int idx = find_sync_index(wp->source);
+        if (idx >= 0 && (!wp->pooled || wp->busy)) busy[idx] = 1;
+    }
+    long long settled = (time(NULL) - 1) * 1000000000LL;
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", state_file);
+    FILE *f = fopen(tmp, "w");
+    if (!f) { perror("fopen state"); free(busy); return; }
+    fprintf(f, "%s\n", STATE_MAGIC);
+    for (int i = 0; i < sync_count; i++) {
+        sync_info_t *si = &sync_table[i];
+        long long mtime, ctime;
+        if (si->active && !busy[i] && !si->queued && !si->catchup && !strcmp(si->last_result, "SUCCESS")
+            && !dir_token(si->source_dir, &mtime, &ctime) && mtime < settled && ctime < settled) {
+            si->token_mtime = mtime;
+            si->token_ctime = ctime;
+        }
+        fprintf(f, "%d\t%s\t%lld\t%lld\t%d\t%s\t%s", si->active, si->last_result,
+                si->token_mtime, si->token_ctime, si->error_count, si->last_sync_time, si->source_dir);
+        for (int k = 0; k < si->target_count; k++) fprintf(f, "\t%s", si->targets[k].dir);
+        fputc('\n', f);
+    }
+    free(busy);
+    if (fflush(f) != 0 || fsync(fileno(f)) < 0 || fclose(f) != 0 || rename(tmp, state_file) < 0)
+        perror("write state");
+}
+
+// apply the checkpoint to the pairs read from the config; pairs added from
+// the console before the restart come back too. Returns, per table index,
+// whether the pair was found in the checkpoint
+char *load_state_file(void) {
+    char *restored = calloc(sync_count + 1, 1);
+    FILE *f = fopen(state_file, "r");
+    if (!f) {
+        if (errno != ENOENT) perror("open state");
+        return restored;
+    }
+    char line[TARGETS_LEN + 1024];
+    if (!fgets(line, sizeof(line), f) || strncmp(line, STATE_MAGIC, strlen(STATE_MAGIC))) {
+        log_message("State checkpoint not recognised; every pair gets a FULL sync.");
+        fclose(f);
+        return restored;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *field[8], *rest = line;
+        int n = 0;
+        while (n < 7 && rest) field[n++] = strsep(&rest, "\t");
+        if (rest) field[n++] = rest;
+        if (n < 8) continue;
+        // the rest of the line is the targets, compared in worker form
+        for (char *p = field[7]; (p = strchr(p, '\t')); ) *p = TARGET_SEP;
+        static const char sep[] = { TARGET_SEP, '\0' };
+        int idx = find_sync_index(field[6]);
+        char *targets = field[7], *target;
+        if (idx < 0) {
+            idx = add_sync_info(field[6], strsep(&targets, sep));
+            if (idx < 0) continue;
+            restored = realloc(restored, sync_count);
+        } else {
+            // targets added from the console follow the config's own; a
+            // source whose config targets changed starts afresh
+            size_t len = strlen(sync_table[idx].target_dir);
+            if (strncmp(sync_table[idx].target_dir, targets, len) || (targets[len] && targets[len] != TARGET_SEP))
+                continue;
+            targets = targets[len] ? targets + len + 1 : NULL;
+        }
+        while ((target = strsep(&targets, sep))) add_sync_target(idx, target);
+        sync_info_t *si = &sync_table[idx];
+        restored[idx] = 1;
+        si->active = atoi(field[0]);
+        snprintf(si->last_result, sizeof(si->last_result), "%s", field[1]);
+        si->token_mtime = atoll(field[2]);
+        si->token_ctime = atoll(field[3]);
+        si->error_count = atoi(field[4]);
+        snprintf(si->last_sync_time, sizeof(si->last_sync_time), "%s", field[5]);
+        // only the pair's result is saved; a success was every target's
+        if (!strcmp(si->last_result, "SUCCESS"))
+            for (int k = 0; k < si->target_count; k++) strcpy(si->targets[k].last_result, "SUCCESS");
+    }
+    fclose(f);
+    return restored;
+}
+
+// restart catch-up: pairs whose source changed while the manager was down
+// get their FULL sync a few at a time (-r), and only once a worker is left
+// over after the live queue, so monitoring is not held up behind them
+static int *catchup_list = NULL;
+static int catchup_count = 0, catchup_next = 0;
+
+void run_catchups(void) {
+    while (catchup_next < catchup_count && catchup_running < catchup_limit && worker_available()) {
+        sync_info_t *si = &sync_table[catchup_list[catchup_next++]];
+        si->catchup = 0;
+        if (!si->active) continue;
+        worker_pipe_t *wp = spawn_worker(si->source_dir, si->target_dir, "ALL", "FULL", 0);
+        if (wp) {
+            wp->catchup = 1;
+            catchup_running++;
+        }
+    }
+}
+
+// the source directory of a restored pair is as the checkpoint left it. Only
+// the top level is looked at: a change further down does not move the token,
+// so every restored pair still gets its catch-up, where the target manifests
+// skip what did not change
+int source_unchanged(const sync_info_t *si) {
+    long long mtime, ctime;
+    return !dir_token(si->source_dir, &mtime, &ctime) && mtime == si->token_mtime && ctime == si->token_ctime;
+}
+
+// per pair, a FULL sync now (new pairs) or a throttled catch-up, those whose
+// token moved or whose last result was not a success first; called once the
+// watches are in place, with what load_state_file() returned
+void start_initial_syncs(char *restored) {
+    int changed = 0, stopped = 0;
+    catchup_list = malloc((sync_count + 1) * sizeof(int));
+    for (int i = 0; i < sync_count; i++) {
+        sync_info_t *si = &sync_table[i];
+        if (!restored[i])
+            spawn_worker(si->source_dir, si->target_dir, "ALL", "FULL", 0);
+        else if (!si->active)
+            stopped++;
+        else if (strcmp(si->last_result, "SUCCESS") || !source_unchanged(si)) {
+            si->catchup = 1;
+            catchup_list[catchup_count++] = i;
+        }
+    }
+    changed = catchup_count;
+    for (int i = 0; i < sync_count; i++) {
+        sync_info_t *si = &sync_table[i];
+        if (restored[i] && si->active && !si->catchup) {
+            si->catchup = 1;
+            catchup_list[catchup_count++] = i;
+        }
     }
+    free(restored);
+    if (state_file) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "State restored: %d pairs changed, %d unchanged, %d stopped; catch-up runs in the background.",
+                 changed, catchup_count - changed, stopped);
+        log_message(msg);
+    }
+    run_catchups();
 }
 
-void sigchld_handler(int signo) {
-    (void)signo;
+// --- console commands ---
+// "add <source> <target> [<target>...]": a new source is watched and synced
+// into all its targets; a monitored one only gains the targets it lacks, and
+// only those get the FULL sync
+int handle_add(const char *source, const char *args, const char *tbuf) {
+    char out[1024], target[256], fresh[TARGETS_LEN] = "";
+    int idx = find_sync_index(source), used;
+    size_t fresh_len = 0;
+    if (idx >= 0 && !sync_table[idx].active) {
+        snprintf(out,sizeof(out),"%s Already in queue: %s\n",tbuf,source); console_write(out,strlen(out)); return 0;
+    }
+    for (const char *p = args; sscanf(p, "%255s%n", target, &used) == 1; p += used) {
+        if (idx < 0) {
+            idx = add_sync_info(source, target);
+            if (idx < 0) { snprintf(out,sizeof(out),"%s Target rejected for %s: %s\n",tbuf,source,target); console_write(out,strlen(out)); return -1; }
+            mkdir(source, 0755);
+        } else {
+            int added = add_sync_target(idx, target);
+            if (added < 0) { snprintf(out,sizeof(out),"%s Target rejected for %s: %s\n",tbuf,source,target); console_write(out,strlen(out)); }
+            if (added <= 0) continue;
+            if (sync_table[idx].inotify_watch >= 0) log_added(&sync_table[idx], target);
+            if (fresh_len) fresh[fresh_len++] = TARGET_SEP;
+            fresh_len += snprintf(fresh + fresh_len, sizeof(fresh) - fresh_len, "%s", target);
+        }
+        mkdir(target, 0755);
+    }
+    sync_info_t *si = idx >= 0 ? &sync_table[idx] : NULL;
+    if (!si) { snprintf(out,sizeof(out),"%s Target required: %s\n",tbuf,source); console_write(out,strlen(out)); return -1; }
+    if (si->inotify_watch < 0) { watch_sync_info(idx); spawn_worker(si->source_dir, si->target_dir, "ALL", "FULL", 0); }
+    else if (fresh_len) spawn_worker(si->source_dir, fresh, "ALL", "FULL", 0);
+    else { snprintf(out,sizeof(out),"%s Already in queue: %s\n",tbuf,source); console_write(out,strlen(out)); }
+    return 0;
+}
+
+// run one command read from fss_in; returns 1 for shutdown, -1 if it failed
+int handle_command(const char *buf) {
+    char cmd[16]="", a1[256]=""; int args = 0; sscanf(buf,"%15s %255s%n",cmd,a1,&args);
+    char tbuf[32], out[1024]; sync_info_t *si = find_sync_info(a1);
+    current_time_str(tbuf,sizeof(tbuf));
+    if (!strcmp(cmd,"add")) return handle_add(a1, buf + args, tbuf);
+    else if (!strcmp(cmd,"stats")) write_stats(a1);
+    else if (!strcmp(cmd,"subscribe") || !strcmp(cmd,"unsubscribe")) {
+        current_client->subscribed = cmd[0] == 's';
+        snprintf(out,sizeof(out),"%s %s worker reports\n",tbuf,current_client->subscribed?"Subscribed to":"Unsubscribed from"); console_write(out,strlen(out));
+    }
+    else if (!strcmp(cmd,"shutdown")) {
+        const char *msgs[]={"Shutting down manager...","Waiting for all active workers to finish.","Processing remaining queued tasks.","Manager shutdown complete."};
+        for(int i=0;i<4;i++){ current_time_str(tbuf,sizeof(tbuf)); snprintf(out,sizeof(out),"%s %s\n",tbuf,msgs[i]); console_write(out,strlen(out)); }
+        while(pending_head) pending_dispatch(pending_head);
+        process_task_queue(); return 1;
+    }
+    else if (strcmp(cmd,"cancel") && strcmp(cmd,"status") && strcmp(cmd,"sync") && strcmp(cmd,"verify")) {
+        snprintf(out,sizeof(out),"%s Unknown command: %s\n",tbuf,cmd); console_write(out,strlen(out)); return -1;
+    }
+    else if (!si) { snprintf(out,sizeof(out),"%s Directory not monitored: %s\n",tbuf,a1); console_write(out,strlen(out)); return -1; }
+    else if (!strcmp(cmd,"cancel")) { snprintf(out,sizeof(out),"%s Monitoring stopped for %s\n",tbuf,a1); console_write(out,strlen(out)); remove_sync_info(a1); }
+    else if (!strcmp(cmd,"status")) {
+        snprintf(out,sizeof(out),"%s Status requested for %s\n",tbuf,a1); console_write(out,strlen(out));
+        snprintf(out,sizeof(out),"Directory: %s\n",si->source_dir); console_write(out,strlen(out));
+        // with several targets each shows its own last result and error count
+        for (int k = 0; k < si->target_count; k++) {
+            sync_target_t *t = &si->targets[k];
+            if (si->target_count == 1) snprintf(out,sizeof(out),"Target: %s\n",t->dir);
+            else snprintf(out,sizeof(out),"Target: %s [%s, %d errors]\n",t->dir,t->last_result,t->error_count);
+            console_write(out,strlen(out));
+        }
+        snprintf(out,sizeof(out),"Last Sync: %s\nErrors: %d\nStatus: %s\n",
+            si->last_sync_time, si->error_count, si->active?"Active":"Not monitored"); console_write(out,strlen(out)); }
+    else if (!strcmp(cmd,"verify")) {
+        // "verify <source> [repair]": the worker reports what differs; with
+        // repair the differing files are queued for copying as well
+        char mode[16] = ""; sscanf(buf + args, "%15s", mode);
+        if (*mode && strcmp(mode,"repair")) { snprintf(out,sizeof(out),"%s Unknown verify mode: %s\n",tbuf,mode); console_write(out,strlen(out)); return -1; }
+        for (int k = 0; k < si->target_count; k++) { snprintf(out,sizeof(out),"%s Verifying directory: %s -> %s\n",tbuf,si->source_dir,si->targets[k].dir); console_write(out,strlen(out)); }
+        spawn_worker(si->source_dir, si->target_dir, *mode ? "REPAIR" : "VERIFY", "VERIFY", 0);
+    }
+    else {
+        for (int k = 0; k < si->target_count; k++) { snprintf(out,sizeof(out),"%s Syncing directory: %s -> %s\n",tbuf,si->source_dir,si->targets[k].dir); console_write(out,strlen(out)); }
+        spawn_worker(si->source_dir, si->target_dir, "ALL", "FULL", 0);
+    }
+    return 0;
+}
+
+// one line from a client: a plain command, or "#<id> command" whose reply
+// is framed and closed by "=<id> END OK|ERROR"
+int handle_line(client_t *c, char *line) {
+    char *cmd = line;
+    long id = -1;
+    if (*line == '#') {
+        id = strtol(line + 1, &cmd, 10);
+        if (cmd == line + 1 || id < 0) id = -1;
+        while (*cmd == ' ') cmd++;
+    }
+    if (!*cmd && id < 0) return 0;
+    current_client = c;
+    request_id = id;
+    int r = handle_command(cmd);
+    request_id = -1;
+    if (id >= 0) {
+        char end[64];
+        client_put(c, end, snprintf(end, sizeof(end), "=%ld END %s\n", id, r < 0 ? "ERROR" : "OK"));
+    }
+    current_client = NULL;
+    return r;
+}
+
+// client input is a byte stream: commands are split on newlines whatever
+// the read boundaries, so a client may write many of them at once.
+// Returns 1 once a command asked for shutdown
+int read_client(client_t *c) {
+    int n, shutdown = 0;
+    while (!shutdown && ((n = read(c->in_fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len)) > 0
+                         || (n < 0 && errno == EINTR))) {
+        if (n < 0) continue;
+        c->in_len += n;
+        char *start = c->in, *nl;
+        while (!shutdown && (nl = memchr(start, '\n', c->in + c->in_len - start))) {
+            *nl = '\0';
+            if (handle_line(c, start) > 0) shutdown = 1;
+            start = nl + 1;
+        }
+        if (start == c->in && c->in_len == sizeof(c->in) - 1) {
+            log_message("Console command too long; dropped.");
+            c->in_len = 0;
+        } else {
+            c->in_len -= start - c->in;
+            memmove(c->in, start, c->in_len);
+        }
+    }
+    if (shutdown) return 1;
+    // the writer went away: an unterminated final command still counts; a
+    // socket client is then done, fss_in waits for the next console
+    if (n == 0 || (n < 0 && errno != EAGAIN)) {
+        if (n == 0 && c->in_len) {
+            c->in[c->in_len] = '\0';
+            c->in_len = 0;
+            if (handle_line(c, c->in) > 0) shutdown = 1;
+        }
+        if (c != &fifo_client) c->closing = n == 0 ? 1 : 2;
+    }
+    return shutdown;
+}
+
+// the kernel dropped events of one shard: which sources they belonged to is
+// unknown, so every source watched there is rescanned
+void inotify_overflowed(int shard) {
+    inotify_overflows++;
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Inotify queue %d overflowed; its sources will be rescanned.", shard);
+    log_message(msg);
+    for (int i = 0; i < sync_count; i++)
+        if (sync_table[i].inotify_watch >= 0 && sync_table[i].watch_shard == shard)
+            mark_dirty(i, "inotify events lost");
+}
+
+// read every queued event of one shard and feed it to the coalescer; the
+// buffer grows to what FIONREAD says is waiting (up to EVENT_BUF_MAX), so a
+// burst is taken in a few large reads rather than many small ones
+void drain_inotify(int shard) {
+    int fd = inotify_fds[shard];
+    for (;;) {
+        int avail = 0;
+        if (ioctl(fd, FIONREAD, &avail) < 0) avail = 0;
+        size_t want = event_buf_len ? event_buf_len : EVENT_BUF_LEN;
+        while (want < (size_t)avail && want < EVENT_BUF_MAX) want *= 2;
+        if (want > event_buf_len) {
+            char *buf = realloc(event_buf, want);
+            if (buf) {
+                event_buf = buf;
+                event_buf_len = want;
+            }
+        }
+        if (!event_buf) break;
+        int len = read(fd, event_buf, event_buf_len);
+        if (len <= 0) break;
+        for (int i=0; i<len; ) {
+            struct inotify_event *e = (void*)(event_buf+i);
+            if (e->mask & IN_Q_OVERFLOW) inotify_overflowed(shard);
+            else {
+                int si = e->len ? find_sync_index_by_watch(shard, e->wd) : -1;
+                if (si >= 0) coalesce_event(si, e->name, e->mask);
+            }
+            i += EVENT_SIZE + e->len;
+        }
+    }
+    flush_pending_events();
+}
+
+// the shard an epoll tag stands for, -1 if it is not an inotify instance
+int inotify_shard_of(void *ptr) {
+    for (int k = 0; k < inotify_shards; k++)
+        if (ptr == &inotify_fds[k]) return k;
+    return -1;
+}
+
+// --- worker reaping ---
+// a pidfd per worker when the kernel has pidfd_open (5.3+), otherwise SIGCHLD
+// blocked and read from a signalfd; either way exits are only noted by epoll
+// and handled in reap_workers(), never in a signal handler
+void init_child_reaping(void) {
+    sigemptyset(&sigchld_mask);
+    sigaddset(&sigchld_mask, SIGCHLD);
+    int probe = syscall(SYS_pidfd_open, getpid(), 0);
+    if (probe >= 0) {
+        close(probe);
+        return;
+    }
+    use_pidfd = 0;
+    sigprocmask(SIG_BLOCK, &sigchld_mask, NULL);
+    child_fd = signalfd(-1, &sigchld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (child_fd < 0) { perror("signalfd"); exit(1); }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &child_fd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, child_fd, &ev) < 0) { perror("epoll_ctl signalfd"); exit(1); }
+}
+
+worker_pipe_t *find_worker_pipe(pid_t pid) {
+    for (worker_pipe_t *wp = worker_pipes; wp; wp = wp->next)
+        if (wp->pid == pid) return wp;
+    return NULL;
+}
+
+// the write end of a pipe outlives the exit notice only until the worker is
+// gone, so reading to EOF here collects its last report before accounting
+void close_worker_pipe(worker_pipe_t *wp) {
+    if (wp->fd < 0) return;
+    while (read_worker_pipe(wp) > 0);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wp->fd, NULL);
+    close(wp->fd);
+    wp->fd = -1;
+}
+
+// one pass over every worker that exited since the last wakeup
+void reap_workers(void) {
+    struct signalfd_siginfo info;
+    if (child_fd >= 0)
+        while (read(child_fd, &info, sizeof(info)) > 0);
     int status;
     pid_t pid;
     while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        worker_pipe_t *wp = find_worker_pipe(pid);
+        if (!wp) continue;
+        close_worker_pipe(wp);
+        if (wp->pooled) {
+            pool_worker_exited(wp);
+            continue;
+        }
+        char msg[512];
         current_worker_count--;
-        char msg[256];
-        snprintf(msg, sizeof(msg), "Worker %d finished.", pid);
+        if (wp->tasks_done == 0) {
+            snprintf(msg, sizeof(msg), "Worker %d died while syncing %s.", pid, wp->source);
+            log_message(msg);
+            update_sync_info(wp->source, wp->target, STATUS_ERROR, NULL, 0);
+        }
+        snprintf(msg, sizeof(msg), "Worker %d finished in %.3f s.", pid,
+                 (now_ns() - wp->spawned_ns) / 1e9);
         log_message(msg);
-        process_task_queue();
+        remove_worker_pipe(pid);
     }
 }
 
@@ -245,115 +2597,158 @@ int main(int argc, char *argv[]) {
     char *logfile     = NULL;
     char *config_file = NULL;
     int opt;
-    while ((opt = getopt(argc, argv, "l:c:n:")) != -1) {
+    while ((opt = getopt(argc, argv, "l:c:n:pd:j:q:ub:m:L:N:Bs:r:S:I:F:P")) != -1) {
         switch(opt) {
             case 'l': logfile     = optarg; break;
             case 'c': config_file = optarg; break;
             case 'n': worker_limit = atoi(optarg); break;
+            case 'p': worker_pool_mode = 1; break;
+            case 'd': debounce_ms = atoi(optarg); break;
+            case 'j': full_threads = optarg; break;
+            case 'q': max_queued = atoi(optarg); break;
+            case 'u': worker_uring = 1; break;
+            case 'b': batch_files = atoi(optarg); break;
+            case 'm': metrics_file = optarg; break;
+            case 'L': log_flush_ms = atoi(optarg); break;
+            case 'N': log_flush_records = atoi(optarg); break;
+            case 'B': log_drop_when_full = 1; break;
+            case 's': state_file = optarg; break;
+            case 'S': control_path = optarg; break;
+            case 'r': catchup_limit = atoi(optarg); break;
+            case 'I': inotify_shards = atoi(optarg); break;
+            case 'F': fsync_policy = optarg; break;
+            case 'P': delta_in_place = 1; break;
             default:
-                fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> [-n worker_limit]\n", argv[0]);
+                fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> [-n worker_limit] [-p] [-d debounce_ms] [-j full_sync_threads] [-q max_queued_per_source] [-u] [-b batch_files] [-m metrics_file] [-L log_flush_ms] [-N log_flush_records] [-B] [-s state_file] [-r catchup_syncs] [-S control_socket] [-I inotify_queues] [-F none|file|batch[:files[:ms]]] [-P]\n", argv[0]);
                 exit(1);
         }
     }
     if (!logfile || !config_file) {
         fprintf(stderr, "Logfile and config_file required\n"); exit(1);
     }
+    if (worker_limit < 1) worker_limit = 1;
+    if (debounce_ms < 0) debounce_ms = 0;
+    if (max_queued < 1) max_queued = 1;
+    if (batch_files > BATCH_MAX_FILES) batch_files = BATCH_MAX_FILES;
+    if (catchup_limit < 1) catchup_limit = 1;
+    if (inotify_shards < 1) inotify_shards = 1;
     cleanup_resources();
-    log_fp = fopen(logfile, "a");
-    if (!log_fp) { perror("fopen log"); exit(1); }
-    struct sigaction sa = { .sa_handler = sigchld_handler };
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGCHLD, &sa, NULL);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) { perror("epoll_create1"); exit(1); }
+    if (start_logging(logfile) < 0) { perror("open log"); exit(1); }
+    init_child_reaping();
+    signal(SIGPIPE, SIG_IGN);
+    if (worker_pool_mode) start_worker_pool();
     if (mkfifo("fss_in", 0666) && errno != EEXIST) { perror("mkfifo in"); exit(1); }
     if (mkfifo("fss_out",0666) && errno != EEXIST) { perror("mkfifo out"); exit(1); }
     FILE *cf = fopen(config_file, "r");
     if (!cf) { perror("open config"); exit(1); }
     char line[MAX_LINE];
+    // "<source> <target> [<target>...]"; a source listed again gains targets
     while (fgets(line, sizeof(line), cf)) {
-        char src[256], dst[256];
-        if (sscanf(line, "%255s %255s", src, dst) != 2) continue;
-        if (find_sync_info(src)) {
-            log_message("Source already registered. New target rejected.");
-            continue;
+        char *save, *src = strtok_r(line, " \t\n", &save), *dst;
+        int idx = src ? find_sync_index(src) : -1;
+        while (src && (dst = strtok_r(NULL, " \t\n", &save))) {
+            if (idx >= 0) {
+                if (add_sync_target(idx, dst) < 0) log_message("Too many targets for source. New target rejected.");
+            } else if ((idx = add_sync_info(src, dst)) < 0) {
+                log_message("Source or target name too long. Pair rejected.");
+                break;
+            }
         }
-        add_sync_info(src, dst);
-        spawn_worker(src, dst, "ALL", "FULL");
     }
     fclose(cf);
-    inotify_fd = inotify_init();
-    for (sync_info_t *si = sync_info_head; si; si = si->next) {
-        int wd = inotify_add_watch(inotify_fd, si->source_dir, IN_CREATE|IN_MODIFY|IN_DELETE);
-        if (wd < 0) perror("inotify_add_watch");
-        else {
-            si->inotify_watch = wd;
-            log_message("Monitoring started.");
-        }
-    }
-    int fifo_in_fd = open("fss_in", O_RDONLY | O_NONBLOCK);
-    if (fifo_in_fd < 0) { perror("open fss_in"); exit(1); }
-    int flags = fcntl(fifo_in_fd, F_GETFL, 0);
-    fcntl(fifo_in_fd, F_SETFL, flags & ~O_NONBLOCK);
-    do {
-        fifo_out_fd = open("fss_out", O_WRONLY | O_NONBLOCK);
-        if (fifo_out_fd < 0 && (errno==ENXIO||errno==ENOENT)) usleep(100000);
-    } while (fifo_out_fd < 0);
-    char buf[1024]; int running = 1;
+    char *restored = state_file ? load_state_file() : calloc(sync_count + 1, 1);
+    inotify_fds = malloc(inotify_shards * sizeof(int));
+    for (int k = 0; k < inotify_shards; k++) {
+        inotify_fds[k] = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fds[k] < 0) { perror("inotify_init1"); exit(1); }
+    }
+    for (int i = 0; i < sync_count; i++)
+        if (sync_table[i].active) watch_sync_info(i);
+    start_initial_syncs(restored);
+    fifo_client.in_fd = open("fss_in", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fifo_client.in_fd < 0) { perror("open fss_in"); exit(1); }
+    // all stay non-blocking: reads are edge-triggered and drained until EAGAIN
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET };
+    for (int k = 0; k < inotify_shards; k++) {
+        ev.data.ptr = &inotify_fds[k];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fds[k], &ev) < 0) { perror("epoll_ctl inotify"); exit(1); }
+    }
+    ev.data.ptr = &fifo_client;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fifo_client.in_fd, &ev) < 0) { perror("epoll_ctl fss_in"); exit(1); }
+    control_fd = open_control_socket(control_path);
+    if (control_fd < 0) {
+        perror("control socket");
+        log_message("Control socket unavailable; only the fss_in/fss_out console is served.");
+    }
+    open_fifo_out();
+    int running = 1, shutting_down = 0;
+    struct epoll_event events[MAX_EVENTS];
+    long long metrics_due = now_ns(), state_due = now_ns() + STATE_PERIOD_MS * 1000000LL;
     while (running) {
-        fd_set rfds; FD_ZERO(&rfds);
-        FD_SET(inotify_fd, &rfds); FD_SET(fifo_in_fd, &rfds);
-        int maxfd = (inotify_fd>fifo_in_fd?inotify_fd:fifo_in_fd)+1;
-        for (worker_pipe_t *wp=worker_pipes; wp; wp=wp->next) {
-            FD_SET(wp->fd, &rfds);
-            if (wp->fd+1 > maxfd) maxfd = wp->fd+1;
-        }
-        if (select(maxfd, &rfds, NULL, NULL, NULL) < 0) {
-            if (errno==EINTR) continue; perror("select"); break;
-        }
-        if (FD_ISSET(inotify_fd, &rfds)) {
-            char evbuf[EVENT_BUF_LEN]; int len = read(inotify_fd, evbuf, sizeof(evbuf));
-            for (int i=0; i<len; ) {
-                struct inotify_event *e = (void*)(evbuf+i);
-                for (sync_info_t *si=sync_info_head; si; si=si->next) {
-                    if (si->inotify_watch==e->wd && e->len) {
-                        const char *op = (e->mask&IN_CREATE)?"ADDED":
-                                         (e->mask&IN_MODIFY)?"MODIFIED":
-                                         (e->mask&IN_DELETE)?"DELETED":NULL;
-                        if (op) spawn_worker(si->source_dir, si->target_dir, e->name, op);
-                    }
-                }
-                i += EVENT_SIZE + e->len;
-            }
+        int reap = 0;
+        int timeout = pending_timeout_ms();
+        int spawn_wait = ready_head >= 0 || catchup_next < catchup_count ? spawn_timeout_ms() : -1;
+        if (spawn_wait >= 0 && (timeout < 0 || spawn_wait < timeout)) timeout = spawn_wait;
+        if (metrics_file) {
+            long long left = (metrics_due - now_ns() + 999999) / 1000000;
+            if (left < 0) left = 0;
+            if (timeout < 0 || left < timeout) timeout = left;
         }
-        if (FD_ISSET(fifo_in_fd, &rfds)) {
-            int n = read(fifo_in_fd, buf, sizeof(buf)-1);
-            if (n>0) {
-                buf[n]='\0'; char cmd[16], a1[256], a2[256]; sscanf(buf,"%15s %255s %255s",cmd,a1,a2);
-                char tbuf[32], out[1024]; sync_info_t *si;
-                if (!strcmp(cmd,"add")) {
-                    if (find_sync_info(a1)) { current_time_str(tbuf,sizeof(tbuf)); snprintf(out,sizeof(out),"%s Already in queue: %s\n", tbuf,a1); write(fifo_out_fd,out,strlen(out)); }
-                    else { mkdir(a1,0755); mkdir(a2,0755); add_sync_info(a1,a2); spawn_worker(a1,a2,"ALL","FULL"); }
-                }
-                else if (!strcmp(cmd,"cancel")) { si=find_sync_info(a1); current_time_str(tbuf,sizeof(tbuf)); snprintf(out,sizeof(out),"%s Monitoring stopped for %s\n",tbuf,a1); write(fifo_out_fd,out,strlen(out)); remove_sync_info(a1);} 
-                else if (!strcmp(cmd,"status")) { si=find_sync_info(a1);
-                    current_time_str(tbuf,sizeof(tbuf)); snprintf(out,sizeof(out),"%s Status requested for %s\n",tbuf,a1); write(fifo_out_fd,out,strlen(out));
-                    snprintf(out,sizeof(out),"Directory: %s\nTarget: %s\nLast Sync: %s\nErrors: %d\nStatus: %s\n",
-                        si->source_dir, si->target_dir, si->last_sync_time, si->error_count, si->active?"Active":"Not monitored"); write(fifo_out_fd,out,strlen(out)); }
-                else if (!strcmp(cmd,"sync")) { si=find_sync_info(a1); current_time_str(tbuf,sizeof(tbuf)); snprintf(out,sizeof(out),"%s Syncing directory: %s -> %s\n",tbuf,si->source_dir,si->target_dir); write(fifo_out_fd,out,strlen(out)); spawn_worker(si->source_dir, si->target_dir, "ALL", "FULL"); }
-                else if (!strcmp(cmd,"shutdown")) {
-                    const char *msgs[]={"Shutting down manager...","Waiting for all active workers to finish.","Processing remaining queued tasks.","Manager shutdown complete."};
-                    for(int i=0;i<4;i++){ current_time_str(tbuf,sizeof(tbuf)); snprintf(out,sizeof(out),"%s %s\n",tbuf,msgs[i]); write(fifo_out_fd,out,strlen(out)); }
-                    process_task_queue(); running=0;
-                }
+        if (state_file) {
+            long long left = (state_due - now_ns() + 999999) / 1000000;
+            if (left < 0) left = 0;
+            if (timeout < 0 || left < timeout) timeout = left;
+        }
+        if (fifo_client.out_fd < 0 && (timeout < 0 || timeout > FIFO_RETRY_MS)) timeout = FIFO_RETRY_MS;
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (ready < 0) {
+            if (errno==EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int k=0; k<ready; k++) {
+            void *src = events[k].data.ptr;
+            int shard = inotify_shard_of(src);
+            if (shard >= 0) { drain_inotify(shard); continue; }
+            if (src == &child_fd) { reap = 1; continue; }
+            if (src == &control_fd) { accept_clients(); continue; }
+            client_t *c = find_client(src);
+            if (c) {
+                if (!shutting_down && read_client(c)) shutting_down = 1;
+                flush_client(c);
+                continue;
             }
+            worker_pipe_t *wp = src; int r;
+            while ((r = read_worker_pipe(wp)) > 0);
+            // the exit itself is picked up through the worker's pidfd
+            if (r == 0) close_worker_pipe(wp);
+        }
+        // completions, queue refill and new events handled once per wakeup
+        if (reap) reap_workers();
+        flush_pending_events();
+        process_task_queue();
+        if (!shutting_down) run_catchups();
+        if (metrics_file && now_ns() >= metrics_due) {
+            write_metrics_file();
+            metrics_due = now_ns() + METRICS_PERIOD_MS * 1000000LL;
         }
-        for(worker_pipe_t *wp=worker_pipes; wp; wp=wp->next) if(FD_ISSET(wp->fd,&rfds)){
-            char wbuf[1024]; int r=read(wp->fd,wbuf,sizeof(wbuf)-1);
-            if(r>0){ wbuf[r]='\0'; char msg[1024]; snprintf(msg,sizeof(msg),"Worker PID %d exec_report:\n%s",wp->pid,wbuf); log_message(msg); write(fifo_out_fd,msg,strlen(msg)); update_sync_info(wp->source,wbuf);} 
-            else if(r==0) remove_worker_pipe(wp->pid);
+        if (state_file && now_ns() >= state_due) {
+            write_state_file();
+            state_due = now_ns() + STATE_PERIOD_MS * 1000000LL;
         }
+        if (fifo_client.out_fd < 0) open_fifo_out();
+        sweep_clients();
+        if(shutting_down && current_worker_count==0 && ready_head < 0 && !pending_head) running=0;
     }
-    while(current_worker_count>0) pause(); cleanup_resources(); if(log_fp) fclose(log_fp); if(fifo_out_fd>=0) close(fifo_out_fd);
+    // closing the task channels makes pool workers exit; reap them before leaving
+    for(worker_pipe_t *wp=worker_pipes; wp; wp=wp->next) if(wp->cmd_fd>=0){ close(wp->cmd_fd); wp->cmd_fd=-1; }
+    if(worker_pool_mode) while(wait(NULL)>0 || errno==EINTR);
+    if (metrics_file) write_metrics_file();
+    if (state_file) write_state_file();
+    drain_clients();
+    cleanup_resources(); stop_logging(); if(fifo_client.out_fd>=0) close(fifo_client.out_fd);
     return 0;
 }
 
@@ -0,0 +1,101 @@
+/* fss_proto.h */
+// exec_report frames exchanged between worker and fss_manager
+#ifndef FSS_PROTO_H
+#define FSS_PROTO_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define REPORT_MAGIC     0x52535346u   // "FSSR"
+#define REPORT_VERSION   6
+#define REPORT_FRAME_MAX (1024 * 1024) // larger frames are treated as corrupt
+
+enum report_status { STATUS_SUCCESS, STATUS_PARTIAL, STATUS_ERROR, STATUS_COUNT };
+enum report_op { OP_FULL, OP_ADDED, OP_MODIFIED, OP_DELETED, OP_BATCH, OP_VERIFY, OP_UNKNOWN, OP_COUNT };
+
+// copy engines, cheapest first; COPY_URING is the worker's batched small-file path
+enum copy_method { COPY_REFLINK, COPY_RANGE, COPY_SENDFILE, COPY_BUFFERED, COPY_URING, COPY_METHODS };
+
+static const char *const status_names[STATUS_COUNT] = { "SUCCESS", "PARTIAL", "ERROR" };
+static const char *const op_names[OP_COUNT] = { "FULL", "ADDED", "MODIFIED", "DELETED", "BATCH", "VERIFY", "UNKNOWN" };
+static const char *const copy_method_names[COPY_METHODS] = { "reflink", "copy_file_range", "sendfile", "read_write", "io_uring" };
+
+// fixed-size head of every frame, all fields in host byte order (both ends
+// run on the same machine); the error list follows at errors_off. A new
+// REPORT_VERSION only appends fields, so an older header is a prefix
+// (header_len long) and the manager reads its missing fields as zero
+typedef struct report_frame {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_len;       // sizeof(report_frame_t) of the sender
+    uint32_t length;           // whole frame, header and error list included
+    uint8_t  status;           // enum report_status
+    uint8_t  operation;        // enum report_op
+    uint16_t threads;
+    uint32_t files_done;
+    uint32_t files_failed;
+    uint32_t files_unchanged;
+    uint32_t errors_dropped;
+    uint32_t copied_by[COPY_METHODS];
+    uint64_t bytes_written;
+    uint64_t bytes_skipped;
+    uint64_t duration_ns;
+    uint32_t errors_off;       // "- File <name>: <error>\n" lines
+    uint32_t errors_len;
+    uint32_t results_off;      // BATCH: one report_file_t per file, in task order;
+                               // VERIFY: one per file that differs, with the repair op
+    uint32_t results_len;
+    uint32_t fsyncs;           // fsync()/syncfs() calls made for the task
+    uint64_t fsync_ns;         // time spent in them
+    uint32_t targets_off;      // several targets: one report_target_t each, in task order
+    uint32_t targets_len;
+    uint64_t bytes_read;       // VERIFY: bytes hashed, source and targets
+} report_frame_t;
+
+// per-file outcome of a BATCH, followed by name_len bytes of the name
+typedef struct report_file {
+    uint8_t  operation;
+    uint8_t  status;           // STATUS_SUCCESS or STATUS_ERROR
+    uint16_t name_len;
+} report_file_t;
+
+// how one target of a task with several fared; the frame's own counts are
+// the sums over its targets
+typedef struct report_target {
+    uint8_t  status;
+    uint8_t  pad[3];
+    uint32_t files_done;
+    uint32_t files_failed;
+    uint32_t files_unchanged;
+} report_target_t;
+
+// a pair's targets travel as one field, joined by TARGET_SEP; config and
+// console paths never contain it
+#define TARGET_SEP  '\x1f'
+#define MAX_TARGETS 16
+
+// workers write each file under this prefix in its target directory and
+// rename it into place when complete; the manager ignores such names
+#define TMP_PREFIX ".fss_tmp."
+
+// a BATCH task on a worker's stdin: "BATCH\t<source>\t<target>\t<count>\n"
+// followed by count "<filename>\t<operation>\n" lines
+#define BATCH_MAX_FILES 256
+#define BATCH_MAX_BYTES 49152      // well under the 64 KiB pipe buffer
+
+static inline int op_from_name(const char *name) {
+    for (int i = 0; i < OP_UNKNOWN; i++)
+        if (!strcmp(op_names[i], name))
+            return i;
+    return OP_UNKNOWN;
+}
+
+static inline const char *status_name(unsigned status) {
+    return status < STATUS_COUNT ? status_names[status] : "ERROR";
+}
+
+static inline const char *op_name(unsigned op) {
+    return op < OP_COUNT ? op_names[op] : "UNKNOWN";
+}
+
+#endif
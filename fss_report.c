@@ -0,0 +1,345 @@
+/* fss_report.c */
+// one-pass reports over a manager (or console) log for fss_script.sh: which
+// source/target pairs were added, which are still monitored, and the last
+// sync of each. With -i the parsed state and the byte offset reached are
+// kept in an index file, so the next run only reads what was appended.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+
+#define HASH_BUCKETS  65536
+#define INDEX_MAGIC   "FSS_REPORT_INDEX 1"
+#define TAIL_BYTES    64        // bytes before the checkpoint that must not change
+#define TS_LEN        19        // "YYYY-MM-DD HH:MM:SS"
+
+// --- per-pair state ---
+typedef struct pair {
+    char *source, *target;
+    char last_sync[TS_LEN + 1];  // empty until a report line is seen
+    char status[16];
+    int  added;                  // seen in an "Added directory" line
+    struct pair *next;
+} pair_t;
+
+typedef struct source_state {
+    char *source;
+    char *last_target;           // target of the latest "Added directory"
+    int  stopped;                // the latest of Added/stopped was a stop
+    struct source_state *next;
+} source_t;
+
+static pair_t *pairs[HASH_BUCKETS];
+static source_t *sources[HASH_BUCKETS];
+static int pair_count = 0;
+
+unsigned hash_mem(const char *s, size_t len, unsigned h) {
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+int mem_is(const char *s, size_t len, const char *z) {
+    return strlen(z) == len && !memcmp(s, z, len);
+}
+
+pair_t *find_pair(const char *src, size_t src_len, const char *tgt, size_t tgt_len, int create) {
+    unsigned h = hash_mem(tgt, tgt_len, hash_mem(src, src_len, 2166136261u) * 16777619u);
+    pair_t **bucket = &pairs[h % HASH_BUCKETS];
+    for (pair_t *p = *bucket; p; p = p->next)
+        if (mem_is(src, src_len, p->source) && mem_is(tgt, tgt_len, p->target))
+            return p;
+    if (!create) return NULL;
+    pair_t *p = calloc(1, sizeof(pair_t));
+    p->source = strndup(src, src_len);
+    p->target = strndup(tgt, tgt_len);
+    p->next = *bucket;
+    *bucket = p;
+    pair_count++;
+    return p;
+}
+
+source_t *find_source(const char *src, size_t len) {
+    source_t **bucket = &sources[hash_mem(src, len, 2166136261u) % HASH_BUCKETS];
+    for (source_t *s = *bucket; s; s = s->next)
+        if (mem_is(src, len, s->source))
+            return s;
+    source_t *s = calloc(1, sizeof(source_t));
+    s->source = strndup(src, len);
+    s->next = *bucket;
+    *bucket = s;
+    return s;
+}
+
+void set_target(source_t *s, const char *tgt, size_t len) {
+    if (s->last_target && mem_is(tgt, len, s->last_target)) return;
+    free(s->last_target);
+    s->last_target = strndup(tgt, len);
+}
+
+// --- log parsing ---
+// "[src] [tgt] [pid] [OP] [STATUS] ..." after the timestamp; fields are
+// returned as (start, length) pairs
+int bracket_fields(const char *p, const char *end, const char **f, size_t *len, int n) {
+    for (int i = 0; i < n; i++) {
+        if (p >= end || *p != '[') return 0;
+        const char *close = memchr(p + 1, ']', end - p - 1);
+        if (!close) return 0;
+        f[i] = p + 1;
+        len[i] = close - p - 1;
+        p = close + 1;
+        if (i < n - 1) {
+            if (p >= end || *p != ' ') return 0;
+            p++;
+        }
+    }
+    return 1;
+}
+
+int is_sync_op(const char *op, size_t len) {
+    return mem_is(op, len, "FULL") || mem_is(op, len, "ADDED") || mem_is(op, len, "MODIFIED")
+        || mem_is(op, len, "DELETED") || mem_is(op, len, "BATCH");
+}
+
+// "[src] [tgt] [pid] [OP] [STATUS] ..." logged at ts
+void parse_report(const char *ts, const char *p, const char *end) {
+    const char *f[5];
+    size_t len[5];
+    if (!bracket_fields(p, end, f, len, 5) || !is_sync_op(f[3], len[3])) return;
+    pair_t *pr = find_pair(f[0], len[0], f[1], len[1], 1);
+    memcpy(pr->last_sync, ts, TS_LEN);
+    pr->last_sync[TS_LEN] = '\0';
+    size_t n = len[4] < sizeof(pr->status) - 1 ? len[4] : sizeof(pr->status) - 1;
+    memcpy(pr->status, f[4], n);
+    pr->status[n] = '\0';
+}
+
+// "[YYYY-MM-DD HH:MM:SS] " at line
+int has_timestamp(const char *line, const char *end) {
+    static const char shape[] = "[dddd-dd-dd dd:dd:dd] ";
+    if (end - line < (long)sizeof(shape) - 1) return 0;
+    for (size_t i = 0; i < sizeof(shape) - 1; i++)
+        if (shape[i] == 'd' ? !isdigit((unsigned char)line[i]) : line[i] != shape[i]) return 0;
+    return 1;
+}
+
+void parse_line(const char *line, const char *end) {
+    // every line of interest starts with "[YYYY-MM-DD HH:MM:SS] ", except a
+    // report line continuing the record before it (a pair's further targets,
+    // as one message): that one is dated by the last timestamp seen
+    static char last_ts[TS_LEN];
+    static int have_ts = 0;
+    if (!has_timestamp(line, end)) {
+        if (have_ts && end > line && line[0] == '[') parse_report(last_ts, line, end);
+        return;
+    }
+    const char *ts = line + 1, *p = line + TS_LEN + 3;
+    memcpy(last_ts, ts, TS_LEN);
+    have_ts = 1;
+    size_t rest = end - p;
+    static const char added[] = "Added directory: ", stopped[] = "Monitoring stopped for ";
+    if (*p == '[') {
+        parse_report(ts, p, end);
+    } else if (rest > sizeof(added) - 1 && !memcmp(p, added, sizeof(added) - 1)) {
+        const char *src = p + sizeof(added) - 1;
+        const char *arrow = memmem(src, end - src, " -> ", 4);
+        if (!arrow) return;
+        const char *tgt = arrow + 4, *tend = tgt;
+        while (tend < end && *tend != ' ') tend++;
+        pair_t *pr = find_pair(src, arrow - src, tgt, tend - tgt, 1);
+        pr->added = 1;
+        source_t *s = find_source(src, arrow - src);
+        s->stopped = 0;
+        set_target(s, tgt, tend - tgt);
+    } else if (rest > sizeof(stopped) - 1 && !memcmp(p, stopped, sizeof(stopped) - 1)) {
+        const char *src = p + sizeof(stopped) - 1, *send = src;
+        while (send < end && *send != ' ') send++;
+        find_source(src, send - src)->stopped = 1;
+    }
+}
+
+// parse complete lines of buf[0, len); returns the bytes consumed
+size_t parse_buffer(const char *buf, size_t len) {
+    const char *p = buf, *end = buf + len;
+    const char *nl;
+    while (p < end && (nl = memchr(p, '\n', end - p))) {
+        parse_line(p, nl);
+        p = nl + 1;
+    }
+    return p - buf;
+}
+
+// --- index ---
+typedef struct checkpoint {
+    unsigned long long dev, ino, offset;
+    unsigned tail_hash;
+} checkpoint_t;
+
+unsigned tail_hash(int fd, unsigned long long offset) {
+    char buf[TAIL_BYTES];
+    size_t n = offset < TAIL_BYTES ? offset : TAIL_BYTES;
+    if (pread(fd, buf, n, offset - n) != (ssize_t)n) return 0;
+    return hash_mem(buf, n, 2166136261u);
+}
+
+// load the state saved for the same log file; returns the offset to resume
+// from, 0 when the index is missing, stale or for another file
+unsigned long long load_index(const char *path, int log_fd, const struct stat *st) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char line[8192];
+    checkpoint_t cp;
+    if (!fgets(line, sizeof(line), f) || strncmp(line, INDEX_MAGIC, strlen(INDEX_MAGIC))
+        || !fgets(line, sizeof(line), f)
+        || sscanf(line, "log %llu %llu %llu %u", &cp.dev, &cp.ino, &cp.offset, &cp.tail_hash) != 4
+        || cp.dev != (unsigned long long)st->st_dev || cp.ino != (unsigned long long)st->st_ino
+        || cp.offset > (unsigned long long)st->st_size || tail_hash(log_fd, cp.offset) != cp.tail_hash) {
+        // rotated, truncated or rewritten: start over
+        fclose(f);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *field[6];
+        int n = 0;
+        for (char *tok = line; n < 6; n++) {
+            field[n] = tok;
+            char *tab = strchr(tok, '\t');
+            if (!tab) { n++; break; }
+            *tab = '\0';
+            tok = tab + 1;
+        }
+        if (n == 6 && !strcmp(field[0], "P")) {
+            pair_t *p = find_pair(field[4], strlen(field[4]), field[5], strlen(field[5]), 1);
+            p->added = atoi(field[1]);
+            snprintf(p->last_sync, sizeof(p->last_sync), "%s", strcmp(field[2], "-") ? field[2] : "");
+            snprintf(p->status, sizeof(p->status), "%s", strcmp(field[3], "-") ? field[3] : "");
+        } else if (n == 4 && !strcmp(field[0], "S")) {
+            source_t *s = find_source(field[2], strlen(field[2]));
+            s->stopped = atoi(field[1]);
+            if (strcmp(field[3], "-")) set_target(s, field[3], strlen(field[3]));
+        }
+    }
+    fclose(f);
+    return cp.offset;
+}
+
+// written to a temporary file and renamed, so a crash leaves the old index
+int save_index(const char *path, int log_fd, const struct stat *st, unsigned long long offset) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    fprintf(f, "%s\nlog %llu %llu %llu %u\n", INDEX_MAGIC, (unsigned long long)st->st_dev,
+            (unsigned long long)st->st_ino, offset, tail_hash(log_fd, offset));
+    for (int b = 0; b < HASH_BUCKETS; b++)
+        for (pair_t *p = pairs[b]; p; p = p->next)
+            fprintf(f, "P\t%d\t%s\t%s\t%s\t%s\n", p->added, *p->last_sync ? p->last_sync : "-",
+                    *p->status ? p->status : "-", p->source, p->target);
+    for (int b = 0; b < HASH_BUCKETS; b++)
+        for (source_t *s = sources[b]; s; s = s->next)
+            fprintf(f, "S\t%d\t%s\t%s\n", s->stopped, s->source, s->last_target ? s->last_target : "-");
+    if (fclose(f) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// --- reports ---
+int cmp_pair(const void *a, const void *b) {
+    const pair_t *x = *(pair_t *const *)a, *y = *(pair_t *const *)b;
+    int c = strcmp(x->source, y->source);
+    return c ? c : strcmp(x->target, y->target);
+}
+
+source_t *lookup_source(const char *src) {
+    for (source_t *s = sources[hash_mem(src, strlen(src), 2166136261u) % HASH_BUCKETS]; s; s = s->next)
+        if (!strcmp(s->source, src)) return s;
+    return NULL;
+}
+
+void print_pair(const pair_t *p, int with_status) {
+    printf("%s -> %s [Last Sync: %s]", p->source, p->target, *p->last_sync ? p->last_sync : "Never");
+    if (with_status) printf(" [%s]", *p->status ? p->status : "UNKNOWN");
+    putchar('\n');
+}
+
+void report(const char *command) {
+    pair_t **list = malloc((pair_count ? pair_count : 1) * sizeof(pair_t *));
+    int n = 0;
+    for (int b = 0; b < HASH_BUCKETS; b++)
+        for (pair_t *p = pairs[b]; p; p = p->next)
+            if (p->added) list[n++] = p;
+    qsort(list, n, sizeof(pair_t *), cmp_pair);
+    if (!strcmp(command, "listAll")) {
+        printf("Listing all directories:\n");
+        for (int i = 0; i < n; i++) print_pair(list[i], 1);
+    } else if (!strcmp(command, "listMonitored")) {
+        printf("Listing monitored directories:\n");
+        for (int i = 0; i < n; i++) {
+            source_t *s = lookup_source(list[i]->source);
+            if (s && !s->stopped) print_pair(list[i], 0);
+        }
+    } else {
+        // a stopped source is listed once, with the target it had last
+        printf("Listing stopped directories:\n");
+        for (int i = 0; i < n; i++) {
+            source_t *s = lookup_source(list[i]->source);
+            if (s && s->stopped && s->last_target && !strcmp(s->last_target, list[i]->target))
+                print_pair(list[i], 0);
+        }
+    }
+    free(list);
+}
+
+int main(int argc, char *argv[]) {
+    const char *log_path = NULL, *index_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:i:")) != -1) {
+        switch (opt) {
+            case 'l': log_path = optarg; break;
+            case 'i': index_path = optarg; break;
+            default: log_path = NULL; optind = argc + 1; break;
+        }
+    }
+    const char *command = optind == argc - 1 ? argv[optind] : NULL;
+    if (!log_path || !command || (strcmp(command, "listAll") && strcmp(command, "listMonitored")
+                                  && strcmp(command, "listStopped"))) {
+        fprintf(stderr, "Usage: %s -l <log_file> [-i <index_file>] listAll|listMonitored|listStopped\n", argv[0]);
+        return 1;
+    }
+    int fd = open(log_path, O_RDONLY);
+    if (fd < 0) { perror(log_path); return 1; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat"); return 1; }
+    unsigned long long offset = index_path ? load_index(index_path, fd, &st) : 0;
+    if (!offset) {
+        // a stale index may have left state behind; start from empty tables
+        for (int b = 0; b < HASH_BUCKETS; b++) pairs[b] = NULL, sources[b] = NULL;
+        pair_count = 0;
+    }
+    // map only what was appended since the checkpoint, from a page boundary
+    size_t size = st.st_size;
+    if (offset < size) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t start = offset & ~(page - 1);
+        char *map = mmap(NULL, size - start, PROT_READ, MAP_PRIVATE, fd, start);
+        if (map == MAP_FAILED) { perror("mmap"); return 1; }
+        madvise(map, size - start, MADV_SEQUENTIAL);
+        offset += parse_buffer(map + (offset - start), size - offset);
+        munmap(map, size - start);
+    }
+    if (index_path && save_index(index_path, fd, &st, offset) < 0)
+        fprintf(stderr, "Warning: could not write index %s: %s\n", index_path, strerror(errno));
+    close(fd);
+    report(command);
+    return 0;
+}
@@ -1,393 +1,2079 @@
-/* fss_manager.c */
+/* worker.c */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <signal.h>
-#include <sys/inotify.h>
 #include <fcntl.h>
-#include <sys/select.h>
-#include <sys/wait.h>
+#include <dirent.h>
 #include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+#include "fss_proto.h"
 
-#define MAX_LINE      256
-#define EVENT_SIZE    (sizeof(struct inotify_event))
-#define EVENT_BUF_LEN (1024 * (EVENT_SIZE + 16))
-
-// Forward declaration
-void spawn_worker(const char *source, const char *target, const char *filename, const char *operation);
-
-// --- sync_info structure ---
-typedef struct sync_info {
-    char source_dir[256];
-    char target_dir[256];
-    int  active;               // 1=monitoring, 0=stopped
-    char last_result[16];      // SUCCESS / PARTIAL / ERROR / NONE
-    char last_sync_time[32];
-    int  error_count;
-    int  inotify_watch;
-    struct sync_info *next;
-} sync_info_t;
-static sync_info_t *sync_info_head = NULL;
-
-// --- task queue ---
-typedef struct task {
-    char source[256];
-    char target[256];
-    char filename[256];
-    char operation[16];
-    struct task *next;
-} task_t;
-static task_t *task_queue_head = NULL, *task_queue_tail = NULL;
-
-void enqueue_task(const char *source, const char *target, const char *filename, const char *operation) {
-    task_t *new_task = malloc(sizeof(task_t));
-    strncpy(new_task->source, source, sizeof(new_task->source));
-    strncpy(new_task->target, target, sizeof(new_task->target));
-    strncpy(new_task->filename, filename, sizeof(new_task->filename));
-    strncpy(new_task->operation, operation, sizeof(new_task->operation));
-    new_task->next = NULL;
-    if (!task_queue_tail) {
-        task_queue_head = task_queue_tail = new_task;
-    } else {
-        task_queue_tail->next = new_task;
-        task_queue_tail = new_task;
+#define PATH_LEN    4096
+#define COPY_BUF    65536
+#define ERRORS_LEN  4096
+#define MAX_FS_PAIRS 32
+#define DELTA_BLOCK    65536
+#define DELTA_MIN_SIZE (1024 * 1024)   // smaller files are simply recopied
+#define MANIFEST_NAME    ".fss_manifest"
+#define MANIFEST_TMP     ".fss_manifest.tmp"
+#define MANIFEST_MAGIC   0x4d535346u     // "FSSM"
+#define MANIFEST_VERSION 1
+#define MAX_THREADS      64
+#define VERIFY_BUF       (1024 * 1024)     // per-thread read size when hashing
+#define RESULTS_MAX      (256 * 1024)      // VERIFY: listed mismatches, well under REPORT_FRAME_MAX
+#define COPY_ATTEMPTS    3                 // copies of a changing source before the last one is kept
+#define TMP_GRACE_SEC    60                // idle temp file of a thread that is gone: stale
+#define TMP_ABANDON_SEC  3600              // idle temp file of anyone: stale
+
+// --- exec_report accumulation ---
+typedef struct report {
+    int    operation;          // enum report_op
+    int    files_done;
+    int    files_failed;
+    int    files_unchanged;    // FULL: skipped because the manifest matched
+    int    threads;            // FULL: traversal threads used
+    int    copied_by[COPY_METHODS];
+    long long bytes_written;
+    long long bytes_skipped;   // already identical on the target (delta sync)
+    long long bytes_read;      // VERIFY: bytes hashed
+    char   errors[ERRORS_LEN];
+    size_t errors_len;
+    int    errors_dropped;
+    int    fsyncs;             // fsync()/syncfs() calls, see -F
+    long long fsync_ns;
+    char  *results;            // BATCH, VERIFY: report_file_t records, NULL otherwise
+    size_t results_len, results_cap;
+    struct timespec started;
+    // a task with several targets keeps one report per target, summed into
+    // the task's own report before it is sent
+    const char *label;         // the target, named in front of each error
+    struct report *parent;     // the task's report, holding the BATCH results
+    struct report *targets;    // the task's report: one per target
+    int    target_count;
+} report_t;
+
+static int binary_reports = 0;   // -b, or -p: framed reports for fss_manager
+
+static void report_init(report_t *r, int operation) {
+    memset(r, 0, sizeof(*r));
+    r->operation = operation;
+    clock_gettime(CLOCK_MONOTONIC, &r->started);
+}
+
+static void report_line(report_t *r, const char *name, const char *what) {
+    r->files_failed++;
+    int prefix = r->label && strcmp(name, r->label);
+    int n = snprintf(r->errors + r->errors_len, sizeof(r->errors) - r->errors_len,
+                     "- File %s%s%s: %s\n", prefix ? r->label : "", prefix ? "/" : "", name, what);
+    if (n < 0 || (size_t)n >= sizeof(r->errors) - r->errors_len) {
+        r->errors[r->errors_len] = '\0';
+        r->errors_dropped++;
+        return;
     }
+    r->errors_len += n;
 }
 
-task_t* dequeue_task() {
-    if (!task_queue_head) return NULL;
-    task_t *t = task_queue_head;
-    task_queue_head = t->next;
-    if (!task_queue_head) task_queue_tail = NULL;
-    return t;
+static void report_error(report_t *r, const char *name, int err) {
+    report_line(r, name, strerror(err));
 }
 
-void process_task_queue() {
-    extern int current_worker_count, worker_limit;
-    while (current_worker_count < worker_limit) {
-        task_t *t = dequeue_task();
-        if (!t) break;
-        spawn_worker(t->source, t->target, t->filename, t->operation);
-        free(t);
+// BATCH: record how one file of the batch went
+static void report_file(report_t *r, const char *name, int operation, int status) {
+    size_t len = strlen(name);
+    if (len > UINT16_MAX) len = UINT16_MAX;
+    size_t need = sizeof(report_file_t) + len;
+    if (r->results_len + need > r->results_cap) {
+        r->results_cap = (r->results_cap ? r->results_cap * 2 : 4096) + need;
+        r->results = realloc(r->results, r->results_cap);
     }
+    report_file_t rec = { operation, status, len };
+    memcpy(r->results + r->results_len, &rec, sizeof(rec));
+    memcpy(r->results + r->results_len + sizeof(rec), name, len);
+    r->results_len += need;
 }
 
-// --- worker_pipe mapping ---
-typedef struct worker_pipe {
-    pid_t pid;
-    int fd;
-    char source[256];
-    struct worker_pipe *next;
-} worker_pipe_t;
-static worker_pipe_t *worker_pipes = NULL;
-
-void add_worker_pipe(pid_t pid, int fd, const char *source) {
-    worker_pipe_t *wp = malloc(sizeof(worker_pipe_t));
-    wp->pid = pid;
-    wp->fd  = fd;
-    strncpy(wp->source, source, sizeof(wp->source));
-    wp->next = worker_pipes;
-    worker_pipes = wp;
-}
-
-void remove_worker_pipe(pid_t pid) {
-    worker_pipe_t **curr = &worker_pipes;
-    while (*curr) {
-        if ((*curr)->pid == pid) {
-            worker_pipe_t *tmp = *curr;
-            *curr = tmp->next;
-            close(tmp->fd);
-            free(tmp);
+static int report_status(const report_t *r) {
+    if (r->files_failed == 0) return STATUS_SUCCESS;
+    if (r->files_done   == 0) return STATUS_ERROR;
+    return STATUS_PARTIAL;
+}
+
+// add src's counters and error lines to dst
+static void report_merge(report_t *dst, const report_t *src) {
+    dst->files_done      += src->files_done;
+    dst->files_failed    += src->files_failed;
+    dst->files_unchanged += src->files_unchanged;
+    dst->bytes_written   += src->bytes_written;
+    dst->bytes_skipped   += src->bytes_skipped;
+    dst->bytes_read      += src->bytes_read;
+    dst->fsyncs          += src->fsyncs;
+    dst->fsync_ns        += src->fsync_ns;
+    if (src->threads > dst->threads) dst->threads = src->threads;
+    for (int k = 0; k < COPY_METHODS; k++) dst->copied_by[k] += src->copied_by[k];
+    size_t room = sizeof(dst->errors) - 1 - dst->errors_len;
+    size_t n = src->errors_len < room ? src->errors_len : room;
+    memcpy(dst->errors + dst->errors_len, src->errors, n);
+    dst->errors_len += n;
+    dst->errors[dst->errors_len] = '\0';
+    dst->errors_dropped += src->errors_dropped + (n < src->errors_len);
+    // VERIFY: whole records only, up to RESULTS_MAX
+    report_file_t rec;
+    for (size_t off = 0; off + sizeof(rec) <= src->results_len; off += sizeof(rec) + rec.name_len) {
+        memcpy(&rec, src->results + off, sizeof(rec));
+        if (dst->results_len + sizeof(rec) + rec.name_len > RESULTS_MAX) break;
+        char name[UINT16_MAX + 1];
+        memcpy(name, src->results + off + sizeof(rec), rec.name_len);
+        name[rec.name_len] = '\0';
+        report_file(dst, name, rec.operation, rec.status);
+    }
+}
+
+static int write_all(int fd, const char *buf, size_t len);
+
+// one report_frame_t followed by the error list, any per-file results and
+// any per-target records, written with a single write() so the manager usually gets it in one read
+static void send_report_frame(const report_t *r) {
+    char more[64] = "";
+    if (r->errors_dropped)
+        snprintf(more, sizeof(more), "- %d more errors not shown\n", r->errors_dropped);
+    size_t more_len = strlen(more);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    report_frame_t f;
+    memset(&f, 0, sizeof(f));
+    f.magic           = REPORT_MAGIC;
+    f.version         = REPORT_VERSION;
+    f.header_len      = sizeof(report_frame_t);
+    f.status          = report_status(r);
+    f.operation       = r->operation;
+    f.threads         = r->threads;
+    f.files_done      = r->files_done;
+    f.files_failed    = r->files_failed;
+    f.files_unchanged = r->files_unchanged;
+    f.errors_dropped  = r->errors_dropped;
+    for (int m = 0; m < COPY_METHODS; m++)
+        f.copied_by[m] = r->copied_by[m];
+    f.bytes_written   = r->bytes_written;
+    f.bytes_skipped   = r->bytes_skipped;
+    f.duration_ns     = (now.tv_sec - r->started.tv_sec) * 1000000000LL
+                      + (now.tv_nsec - r->started.tv_nsec);
+    f.errors_off      = sizeof(report_frame_t);
+    f.errors_len      = r->errors_len + more_len;
+    f.results_off     = f.errors_off + f.errors_len;
+    f.results_len     = r->results_len;
+    f.fsyncs          = r->fsyncs;
+    f.fsync_ns        = r->fsync_ns;
+    f.targets_off     = f.results_off + f.results_len;
+    f.targets_len     = r->target_count * sizeof(report_target_t);
+    f.bytes_read      = r->bytes_read;
+    f.length          = f.targets_off + f.targets_len;
+    char *out = malloc(f.length);
+    if (!out) return;
+    memcpy(out, &f, sizeof(f));
+    memcpy(out + f.errors_off, r->errors, r->errors_len);
+    memcpy(out + f.errors_off + r->errors_len, more, more_len);
+    if (r->results_len) memcpy(out + f.results_off, r->results, r->results_len);
+    for (int k = 0; k < r->target_count; k++) {
+        const report_t *t = &r->targets[k];
+        report_target_t rec = { .status = report_status(t), .files_done = t->files_done,
+                                .files_failed = t->files_failed, .files_unchanged = t->files_unchanged };
+        memcpy(out + f.targets_off + k * sizeof(rec), &rec, sizeof(rec));
+    }
+    write_all(STDOUT_FILENO, out, f.length);
+    free(out);
+}
+
+// framed for fss_manager, plain text for runs by hand
+static void print_report(const report_t *r) {
+    if (binary_reports) {
+        send_report_frame(r);
+        return;
+    }
+    printf("EXEC_REPORT_START\n");
+    printf("OPERATION: %s\n", op_name(r->operation));
+    printf("STATUS: %s\n", status_name(report_status(r)));
+    if (r->operation == OP_DELETED)
+        printf("DETAILS: %d files deleted, %d failed\n", r->files_done, r->files_failed);
+    else if (r->operation == OP_BATCH)
+        printf("DETAILS: %d files synced, %d unchanged, %d failed\n",
+               r->files_done, r->files_unchanged, r->files_failed);
+    else if (r->operation == OP_FULL)
+        printf("DETAILS: %d files copied, %d unchanged, %d failed\n",
+               r->files_done, r->files_unchanged, r->files_failed);
+    else if (r->operation == OP_VERIFY)
+        printf("DETAILS: %d files match, %d differ or failed\n", r->files_done, r->files_failed);
+    else
+        printf("DETAILS: %d files copied, %d failed\n", r->files_done, r->files_failed);
+    printf("COPY_METHODS:");
+    for (int m = 0; m < COPY_METHODS; m++)
+        printf(" %s=%d", copy_method_names[m], r->copied_by[m]);
+    printf("\n");
+    printf("BYTES: written=%lld skipped=%lld\n", r->bytes_written, r->bytes_skipped);
+    if (r->bytes_read)
+        printf("READ: bytes=%lld\n", r->bytes_read);
+    if (r->threads > 1)
+        printf("THREADS: %d\n", r->threads);
+    if (r->fsyncs)
+        printf("FSYNC: calls=%d ms=%.3f\n", r->fsyncs, r->fsync_ns / 1e6);
+    for (int k = 0; k < r->target_count; k++) {
+        const report_t *t = &r->targets[k];
+        printf("TARGET: %s %s done=%d unchanged=%d failed=%d\n", t->label,
+               status_name(report_status(t)), t->files_done, t->files_unchanged, t->files_failed);
+    }
+    printf("ERRORS:\n%s", r->errors);
+    if (r->errors_dropped)
+        printf("- %d more errors not shown\n", r->errors_dropped);
+    if (r->results_len) {
+        printf("FILES:\n");
+        for (size_t off = 0; off < r->results_len; ) {
+            report_file_t rec;
+            memcpy(&rec, r->results + off, sizeof(rec));
+            printf("- %s %.*s: %s\n", op_name(rec.operation), rec.name_len,
+                   r->results + off + sizeof(rec), status_name(rec.status));
+            off += sizeof(rec) + rec.name_len;
+        }
+    }
+    printf("EXEC_REPORT_END\n");
+    fflush(stdout);
+}
+
+// --- file operations ---
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+// --- durability ---
+// files are written under a temp name in their target directory and renamed
+// over the target, so a reader sees the old file or the new one, never a
+// partial copy. -F decides when data reaches the disk:
+//   none   no fsync: the rename is atomic, but not durable
+//   file   each file is fsynced before its rename, its directory after
+//   batch  renames wait in a per-thread group; every group_files files or
+//          group_ms ms one syncfs() makes the group's data durable and then
+//          its renames run. A task's last group, renames included, is synced
+//          before its report goes out
+enum fsync_policy { FSYNC_NONE, FSYNC_FILE, FSYNC_BATCH };
+static int fsync_policy = FSYNC_NONE;
+static int delta_in_place = 0;   // -P: delta may patch a target that cannot be cloned in place
+static int group_files = 256;
+static int group_ms = 100;
+// batch: the target filesystems with renames or unlinks not yet synced, one
+// descriptor each (a pair's targets may sit on different filesystems)
+#define MAX_SYNC_FS 32
+typedef struct unsynced {
+    int   fd;
+    dev_t dev;
+} unsynced_t;
+static __thread unsynced_t unsynced[MAX_SYNC_FS];
+static __thread int unsynced_count = 0;
+
+static long long mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// "<dir>/.fss_tmp.<tid>.<n>" next to dst_path: unique among the threads and
+// workers writing one directory, and short whatever the file's own name
+static void temp_name(const char *dst_path, char *tmp, size_t size) {
+    static __thread unsigned seq = 0;
+    const char *slash = strrchr(dst_path, '/');
+    int dir_len = slash ? (int)(slash - dst_path) : 1;
+    snprintf(tmp, size, "%.*s/" TMP_PREFIX "%ld.%u", dir_len, slash ? dst_path : ".",
+             (long)syscall(SYS_gettid), seq++);
+}
+
+// "none", "file" or "batch[:files[:ms]]"; -1 if not understood
+static int parse_fsync_policy(const char *arg) {
+    char name[16];
+    int files = group_files, ms = group_ms;
+    if (sscanf(arg, "%15[^:]:%d:%d", name, &files, &ms) < 1) return -1;
+    if (!strcmp(name, "none")) fsync_policy = FSYNC_NONE;
+    else if (!strcmp(name, "file")) fsync_policy = FSYNC_FILE;
+    else if (!strcmp(name, "batch")) fsync_policy = FSYNC_BATCH;
+    else return -1;
+    group_files = files < 1 ? 1 : files;
+    group_ms = ms < 0 ? 0 : ms;
+    return 0;
+}
+
+// fsync() one file, or syncfs() the filesystem holding it, counting the call
+static int timed_sync(int fd, int whole_fs, report_t *r) {
+    long long start = mono_ns();
+    int err = (whole_fs ? syncfs(fd) : fsync(fd)) < 0 ? errno : 0;
+    r->fsyncs++;
+    r->fsync_ns += mono_ns() - start;
+    return err;
+}
+
+// make renames and unlinks in a directory durable
+static int sync_dir(const char *dir, report_t *r) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    int err = timed_sync(fd, 0, r);
+    close(fd);
+    return err;
+}
+
+static int open_parent(const char *path) {
+    char dir[PATH_LEN];
+    const char *slash = strrchr(path, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) : 1, slash ? path : ".");
+    return open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static int sync_parent(const char *path, report_t *r) {
+    int fd = open_parent(path);
+    if (fd < 0) return errno;
+    int err = timed_sync(fd, 0, r);
+    close(fd);
+    return err;
+}
+
+// batch: the filesystem holding path has changes to sync; returns its slot
+// in unsynced[], or -1 with errno set
+static int note_unsynced(const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0) return -1;
+    for (int i = 0; i < unsynced_count; i++)
+        if (unsynced[i].dev == st.st_dev) return i;
+    if (unsynced_count == MAX_SYNC_FS) { errno = EMFILE; return -1; }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    unsynced[unsynced_count] = (unsynced_t){ fd, st.st_dev };
+    return unsynced_count++;
+}
+
+// --- copy engine ---
+// the first engine worth trying for each (source fs, target fs) pair; an engine
+// that reports itself unsupported once is skipped for that pair from then on
+typedef struct fs_pair {
+    dev_t src_dev, dst_dev;
+    int   first;
+    int   cloned;              // a FICLONE between them has succeeded
+} fs_pair_t;
+// per thread, so FULL sync threads learn independently without locking
+static __thread fs_pair_t fs_pairs[MAX_FS_PAIRS];
+static __thread int fs_pair_count = 0;
+
+static fs_pair_t *lookup_fs_pair(dev_t src_dev, dev_t dst_dev) {
+    for (int i = 0; i < fs_pair_count; i++)
+        if (fs_pairs[i].src_dev == src_dev && fs_pairs[i].dst_dev == dst_dev)
+            return &fs_pairs[i];
+    static __thread fs_pair_t scratch;
+    fs_pair_t *p = fs_pair_count < MAX_FS_PAIRS ? &fs_pairs[fs_pair_count++] : &scratch;
+    p->src_dev = src_dev;
+    p->dst_dev = dst_dev;
+    p->first = COPY_REFLINK;
+    p->cloned = 0;
+    return p;
+}
+
+// errors meaning "this engine cannot copy between these files", not a real failure
+static int engine_unsupported(int err) {
+    return err == EOPNOTSUPP || err == ENOTSUP || err == EXDEV || err == EINVAL
+        || err == ENOSYS || err == ENOTTY || err == EBADF;
+}
+
+// copy in[*off..size) to out at the same offsets with one engine; returns 0 or
+// an errno value and advances *off by what was copied
+static int copy_with(int method, int in, int out, off_t *off, off_t size) {
+    if (method == COPY_REFLINK)
+        return ioctl(out, FICLONE, in) < 0 ? errno : (*off = size, 0);
+    if (method == COPY_RANGE) {
+        while (*off < size) {
+            loff_t off_in = *off, off_out = *off;
+            ssize_t n = copy_file_range(in, &off_in, out, &off_out, size - *off, 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            if (n == 0) return EINVAL;   // some filesystems stop short; let the next engine finish
+            *off += n;
+        }
+        return 0;
+    }
+    if (method == COPY_SENDFILE) {
+        if (lseek(out, *off, SEEK_SET) < 0) return errno;
+        while (*off < size) {
+            ssize_t n = sendfile(out, in, off, size - *off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            if (n == 0) return EINVAL;
+        }
+        return 0;
+    }
+    char buf[COPY_BUF];
+    if (lseek(out, *off, SEEK_SET) < 0) return errno;
+    for (;;) {
+        ssize_t r = pread(in, buf, sizeof(buf), *off);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (r == 0) return 0;
+        if (write_all(out, buf, r) < 0) return errno;
+        *off += r;
+    }
+}
+
+// run the engines from the pair's first onwards until one finishes the copy;
+// returns 0 or an errno value and stores the engine that finished it
+static int copy_engines(fs_pair_t *pair, int in, int out, off_t size, int *method_used, long long *bytes) {
+    off_t off = 0;
+    int err = 0;
+    for (int m = pair->first; m <= COPY_BUFFERED; m++) {
+        err = copy_with(m, in, out, &off, size);
+        if (!err && m == COPY_REFLINK) pair->cloned = 1;
+        if (m == COPY_BUFFERED || !err) { *method_used = m; *bytes = off; break; }
+        if (!engine_unsupported(err)) break;
+        if (off == 0 && m == pair->first) pair->first = m + 1;
+    }
+    return err;
+}
+
+// copy one regular file to a new temp file with the cheapest engine the
+// filesystems allow; returns 0 or an errno value and stores the engine that
+// finished the copy
+static int copy_file(const char *src_path, const char *tmp_path, int *method_used, long long *bytes, report_t *r) {
+    int in = open(src_path, O_RDONLY);
+    if (in < 0) return errno;
+    struct stat st, dst_st;
+    if (fstat(in, &st) < 0) { int e = errno; close(in); return e; }
+    int out = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 0777);
+    if (out < 0) { int e = errno; close(in); return e; }
+    if (fstat(out, &dst_st) < 0) { int e = errno; close(out); close(in); return e; }
+
+    fs_pair_t *pair = lookup_fs_pair(st.st_dev, dst_st.st_dev);
+    int err = copy_engines(pair, in, out, st.st_size, method_used, bytes);
+    if (!err && fsync_policy == FSYNC_FILE) err = timed_sync(out, 0, r);
+    if (close(out) < 0 && !err) err = errno;
+    close(in);
+    return err;
+}
+
+// --- per-target manifest ---
+// <target>/.fss_manifest records what the last FULL sync copied, sorted by
+// path hash so the previous manifest can be searched in place through mmap;
+// a FULL sync builds a fresh one and renames it over the old one
+typedef struct manifest_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+} manifest_header_t;
+
+typedef struct manifest_entry {
+    uint64_t path_hash;        // FNV-1a of the path relative to the source
+    uint64_t size;
+    int64_t  mtime_ns;
+    uint64_t ino;
+    uint64_t content_hash;     // 0 = not computed
+} manifest_entry_t;
+
+typedef struct manifest {
+    void   *map;
+    size_t  map_len;
+    const manifest_entry_t *old;
+    size_t  old_count;
+    manifest_entry_t *fresh;
+    size_t  fresh_count, fresh_cap;
+} manifest_t;
+
+static uint64_t hash_path(const char *s) {
+    uint64_t h = 14695981039346656037ull;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    return h;
+}
+
+static int64_t mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static void manifest_open(manifest_t *m, const char *target) {
+    memset(m, 0, sizeof(*m));
+    char path[PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", target, MANIFEST_NAME);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(manifest_header_t)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            const manifest_header_t *h = map;
+            if (h->magic == MANIFEST_MAGIC && h->version == MANIFEST_VERSION
+                && sizeof(*h) + h->count * sizeof(manifest_entry_t) == (size_t)st.st_size) {
+                m->map = map;
+                m->map_len = st.st_size;
+                m->old = (const manifest_entry_t *)(h + 1);
+                m->old_count = h->count;
+                madvise(map, st.st_size, MADV_RANDOM);
+            } else {
+                munmap(map, st.st_size);
+            }
+        }
+    }
+    close(fd);
+}
+
+static const manifest_entry_t *manifest_lookup(const manifest_t *m, uint64_t path_hash) {
+    size_t lo = 0, hi = m->old_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m->old[mid].path_hash < path_hash) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < m->old_count && m->old[lo].path_hash == path_hash ? &m->old[lo] : NULL;
+}
+
+// the source file is as the last FULL sync left it
+static int manifest_unchanged(const manifest_t *m, uint64_t path_hash, const struct stat *st) {
+    const manifest_entry_t *e = manifest_lookup(m, path_hash);
+    return e && e->size == (uint64_t)st->st_size && e->mtime_ns == mtime_ns(st) && e->ino == st->st_ino;
+}
+
+static void manifest_record(manifest_t *m, uint64_t path_hash, const struct stat *st) {
+    if (m->fresh_count == m->fresh_cap) {
+        m->fresh_cap = m->fresh_cap ? m->fresh_cap * 2 : 1024;
+        m->fresh = realloc(m->fresh, m->fresh_cap * sizeof(manifest_entry_t));
+    }
+    manifest_entry_t *e = &m->fresh[m->fresh_count++];
+    e->path_hash = path_hash;
+    e->size = st->st_size;
+    e->mtime_ns = mtime_ns(st);
+    e->ino = st->st_ino;
+    e->content_hash = 0;
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    uint64_t x = ((const manifest_entry_t *)a)->path_hash, y = ((const manifest_entry_t *)b)->path_hash;
+    return x < y ? -1 : x > y;
+}
+
+// write the fresh manifest next to the old one and atomically replace it
+static int manifest_commit(manifest_t *m, const char *target, report_t *r) {
+    qsort(m->fresh, m->fresh_count, sizeof(manifest_entry_t), cmp_entry);
+    char tmp[PATH_LEN], path[PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s/%s", target, MANIFEST_TMP);
+    snprintf(path, sizeof(path), "%s/%s", target, MANIFEST_NAME);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return errno;
+    manifest_header_t h = { MANIFEST_MAGIC, MANIFEST_VERSION, m->fresh_count };
+    int err = 0;
+    if (write_all(fd, (const char *)&h, sizeof(h)) < 0
+        || write_all(fd, (const char *)m->fresh, m->fresh_count * sizeof(manifest_entry_t)) < 0)
+        err = errno;
+    if (!err) err = timed_sync(fd, 0, r);
+    if (close(fd) < 0 && !err) err = errno;
+    if (!err && rename(tmp, path) < 0) err = errno;
+    if (err) unlink(tmp);
+    return err;
+}
+
+static void manifest_close(manifest_t *m) {
+    if (m->map) munmap(m->map, m->map_len);
+    free(m->fresh);
+    memset(m, 0, sizeof(*m));
+}
+
+// a file the manifest recorded was not installed after all
+static void manifest_forget(manifest_t *m, uint64_t path_hash) {
+    for (size_t k = m->fresh_count; k-- > 0; )
+        if (m->fresh[k].path_hash == path_hash) {
+            m->fresh[k].mtime_ns = -1;
             return;
         }
-        curr = &((*curr)->next);
+}
+
+// --- group commit ---
+typedef struct staged {
+    char *tmp, *dst, *name, *src;
+    struct stat st;            // the source as it was read
+    report_t *r;               // the report that already counted the file
+    manifest_t *m;
+    uint64_t path_hash;
+    int fs;                    // slot in unsynced[] while flushing, -errno if none
+} staged_t;
+static __thread staged_t *staged = NULL;
+static __thread int staged_count = 0, staged_cap = 0;
+static __thread long long staged_since = 0;
+
+// two tasks for one file may run at once, each copying what it read; a
+// copy whose source has changed since must not be renamed over a newer one
+static int source_changed(const char *src_path, const struct stat *st) {
+    struct stat now;
+    return lstat(src_path, &now) < 0 || now.st_size != st->st_size
+        || mtime_ns(&now) != mtime_ns(st) || now.st_ino != st->st_ino;
+}
+
+// copy a changed source into tmp again until a copy ends with the source as
+// it began, at most COPY_ATTEMPTS times in all; a file that is written
+// without pause keeps its last copy. Only files at the top are watched, so
+// the copy cannot be left to a later task. Returns 0 or an errno value (the
+// source may be gone), and tmp is gone on failure
+static int recopy(const char *tmp, const char *src_path, report_t *r) {
+    for (int attempt = 1; attempt < COPY_ATTEMPTS; attempt++) {
+        struct stat now;
+        int method, err = lstat(src_path, &now) < 0 ? errno : 0;
+        long long bytes = 0;
+        unlink(tmp);
+        if (!err) err = copy_file(src_path, tmp, &method, &bytes, r);
+        if (err) { unlink(tmp); return err; }
+        r->bytes_written += bytes;
+        if (!source_changed(src_path, &now)) break;
     }
+    return 0;
 }
 
-// Global inotify fd for removal in remove_sync_info
-static int inotify_fd = -1;
+// make a recopied temp file durable again under the batch policy
+static int sync_file(const char *path, report_t *r) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    int err = timed_sync(fd, 0, r);
+    close(fd);
+    return err;
+}
 
-// --- sync_info helpers ---
-void add_sync_info(const char *source, const char *target) {
-    sync_info_t *node = malloc(sizeof(sync_info_t));
-    strncpy(node->source_dir, source, sizeof(node->source_dir));
-    strncpy(node->target_dir, target, sizeof(node->target_dir));
-    node->active = 1;
-    strcpy(node->last_result, "NONE");
-    strcpy(node->last_sync_time, "Never");
-    node->error_count = 0;
-    node->inotify_watch = -1;
-    node->next = sync_info_head;
-    sync_info_head = node;
+// BATCH: a file already reported as done failed after all
+static void result_failed(report_t *r, const char *name) {
+    size_t len = strlen(name), found = SIZE_MAX;
+    report_file_t rec;
+    for (size_t off = 0; off + sizeof(rec) <= r->results_len; off += sizeof(rec) + rec.name_len) {
+        memcpy(&rec, r->results + off, sizeof(rec));
+        if (rec.name_len == len && !memcmp(r->results + off + sizeof(rec), name, len)) found = off;
+    }
+    if (found == SIZE_MAX) return;
+    memcpy(&rec, r->results + found, sizeof(rec));
+    rec.status = STATUS_ERROR;
+    memcpy(r->results + found, &rec, sizeof(rec));
 }
 
-sync_info_t *find_sync_info(const char *source) {
-    for (sync_info_t *cur = sync_info_head; cur; cur = cur->next)
-        if (strcmp(cur->source_dir, source) == 0)
-            return cur;
-    return NULL;
+static void unstage_failed(staged_t *s, int err) {
+    unlink(s->tmp);
+    s->r->files_done--;
+    report_error(s->r, s->name, err);
+    report_t *task = s->r->parent ? s->r->parent : s->r;
+    if (task->results) result_failed(task, s->name);
+    if (s->m) manifest_forget(s->m, s->path_hash);
 }
 
-void remove_sync_info(const char *source) {
-    sync_info_t *si = find_sync_info(source);
-    if (si) {
-        si->active = 0;
-        if (inotify_fd >= 0 && si->inotify_watch >= 0) {
-            inotify_rm_watch(inotify_fd, si->inotify_watch);
-            si->inotify_watch = -1;
+// one syncfs() per filesystem for the data of every staged file, then their
+// renames; with final (the report about to go out) the renames are synced too
+static void flush_staged(report_t *final) {
+    if (staged_count) {
+        int err[MAX_SYNC_FS];
+        for (int i = 0; i < staged_count; i++)
+            if ((staged[i].fs = note_unsynced(staged[i].tmp)) < 0) staged[i].fs = -errno;
+        for (int k = 0; k < unsynced_count; k++)
+            err[k] = timed_sync(unsynced[k].fd, 1, staged[0].r);
+        for (int i = 0; i < staged_count; i++) {
+            staged_t *st = &staged[i];
+            int e = st->fs < 0 ? -st->fs : err[st->fs];
+            if (!e && source_changed(st->src, &st->st) && !(e = recopy(st->tmp, st->src, st->r)))
+                e = sync_file(st->tmp, st->r);
+            if (!e && rename(st->tmp, st->dst) < 0) e = errno;
+            if (e) unstage_failed(st, e);
+            free(st->tmp);
+            free(st->dst);
+            free(st->name);
+            free(st->src);
         }
+        staged_count = 0;
+    }
+    if (final) {
+        for (int k = 0; k < unsynced_count; k++) {
+            int err = timed_sync(unsynced[k].fd, 1, final);
+            if (err) report_error(final, "syncfs", err);
+            close(unsynced[k].fd);
+        }
+        unsynced_count = 0;
     }
 }
 
-// update last_sync_time, error_count and last_result from exec_report
-void update_sync_info(const char *source, const char *exec_report) {
-    sync_info_t *info = find_sync_info(source);
-    if (!info) return;
-    char buf[32];
-    time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm);
-    strncpy(info->last_sync_time, buf, sizeof(info->last_sync_time));
-    char *st = strstr(exec_report, "STATUS:");
-    if (st) {
-        char status_str[16];
-        sscanf(st, "STATUS: %15s", status_str);
-        strncpy(info->last_result, status_str, sizeof(info->last_result));
-        if (strcmp(status_str, "ERROR") == 0 || strcmp(status_str, "PARTIAL") == 0)
-            info->error_count++;
+// called between files, where no report is half written
+static void maybe_flush_staged(void) {
+    if (staged_count && (staged_count >= group_files || mono_ns() - staged_since >= group_ms * 1000000LL))
+        flush_staged(NULL);
+}
+
+// put a completely written temp file copied from src_path (as st) in place
+// of dst per -F, copying it again first if the source changed since; returns
+// 0 or an errno value, and the temp file is gone on failure. Under the batch
+// policy the caller counts the file now and a failed rename takes it back later
+static int install_file(const char *tmp, const char *dst, const char *name, const char *src_path,
+                        const struct stat *st, report_t *r, manifest_t *m, uint64_t path_hash) {
+    if (fsync_policy == FSYNC_BATCH) {
+        if (staged_count == staged_cap) {
+            staged_cap = staged_cap ? staged_cap * 2 : 64;
+            staged = realloc(staged, staged_cap * sizeof(staged_t));
+        }
+        if (!staged_count) staged_since = mono_ns();
+        staged[staged_count++] = (staged_t){ strdup(tmp), strdup(dst), strdup(name), strdup(src_path),
+                                             *st, r, m, path_hash, 0 };
+        return 0;
     }
+    if (source_changed(src_path, st)) {
+        int err = recopy(tmp, src_path, r);
+        if (err) return err;
+    }
+    if (rename(tmp, dst) < 0) {
+        int err = errno;
+        unlink(tmp);
+        return err;
+    }
+    return fsync_policy == FSYNC_FILE ? sync_parent(dst, r) : 0;
 }
 
-// --- logging & utilities ---
-static FILE *log_fp = NULL;
+// --- delta sync ---
+static int read_block(int fd, char *buf, size_t len, off_t off, ssize_t *got) {
+    *got = 0;
+    while ((size_t)*got < len) {
+        ssize_t n = pread(fd, buf + *got, len - *got, off + *got);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        if (n == 0) break;
+        *got += n;
+    }
+    return 0;
+}
 
-void current_time_str(char *buffer, size_t size) {
-    time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
-    strftime(buffer, size, "[%Y-%m-%d %H:%M:%S]", tm);
+// bring an existing target in line with source by rewriting only the blocks
+// that differ; both files are local, so blocks are compared directly instead
+// of through checksums. The patch goes onto a reflink clone of the target in
+// tmp_path, so the target is never seen half patched. Where the target's
+// filesystem cannot clone, -P patches the target itself (*in_place is set;
+// nothing is left to install) and otherwise the file gets a full copy, as
+// does a source already seen to clone outright. Returns 0, an errno value or
+// -1 for "make a full copy".
+static int delta_file(const char *src_path, const char *dst_path, const char *tmp_path,
+                      long long *written, long long *skipped, int *in_place, report_t *r) {
+    int in = open(src_path, O_RDONLY);
+    if (in < 0) return errno;
+    int old = open(dst_path, O_RDONLY);
+    if (old < 0) { close(in); return -1; }
+    struct stat st, dst_st;
+    if (fstat(in, &st) < 0 || fstat(old, &dst_st) < 0) { int e = errno; close(old); close(in); return e; }
+    fs_pair_t *pair = lookup_fs_pair(st.st_dev, dst_st.st_dev);
+    fs_pair_t *clone = lookup_fs_pair(dst_st.st_dev, dst_st.st_dev);
+    if (st.st_size < DELTA_MIN_SIZE || !S_ISREG(dst_st.st_mode) || pair->cloned) {
+        close(old);
+        close(in);
+        return -1;
+    }
+    int out = -1;
+    if (clone->first == COPY_REFLINK) {
+        out = open(tmp_path, O_RDWR | O_CREAT | O_EXCL, st.st_mode & 0777);
+        if (out < 0) { int e = errno; close(old); close(in); return e; }
+        if (ioctl(out, FICLONE, old) == 0) clone->cloned = 1;
+        else {
+            int e = errno;
+            close(out);
+            unlink(tmp_path);
+            out = -1;
+            if (!engine_unsupported(e)) { close(old); close(in); return -1; }
+            clone->first = COPY_RANGE;
+        }
+    }
+    close(old);
+    if (out < 0) {
+        if (!delta_in_place) { close(in); return -1; }
+        out = open(dst_path, O_RDWR);
+        if (out < 0) { close(in); return -1; }
+        *in_place = 1;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(out, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char src_buf[DELTA_BLOCK], dst_buf[DELTA_BLOCK];
+    int err = 0;
+    off_t off = 0;
+    for (;;) {
+        ssize_t got, have;
+        if ((err = read_block(in, src_buf, sizeof(src_buf), off, &got))) break;
+        if (got == 0) break;
+        if ((err = read_block(out, dst_buf, got, off, &have))) break;
+        if (have == got && memcmp(src_buf, dst_buf, got) == 0) {
+            *skipped += got;
+        } else {
+            for (ssize_t done = 0; done < got; ) {
+                ssize_t w = pwrite(out, src_buf + done, got - done, off + done);
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    err = errno;
+                    break;
+                }
+                done += w;
+            }
+            if (err) break;
+            *written += got;
+        }
+        off += got;
+    }
+    if (!err && dst_st.st_size != off && ftruncate(out, off) < 0) err = errno;
+    // a patch in place is not staged, so batch syncs it here as well
+    if (!err && (fsync_policy == FSYNC_FILE || (*in_place && fsync_policy == FSYNC_BATCH)))
+        err = timed_sync(out, 0, r);
+    if (close(out) < 0 && !err) err = errno;
+    close(in);
+    if (err && !*in_place) unlink(tmp_path);
+    return err;
 }
 
-void log_message(const char *message) {
-    char tbuf[32];
-    current_time_str(tbuf, sizeof(tbuf));
-    fprintf(stdout, "%s %s
-", tbuf, message);
-    if (log_fp) {
-        fprintf(log_fp, "%s %s
-", tbuf, message);
-        fflush(log_fp);
+// install a finished full copy (err is how writing it went) and count it
+static void finish_copy(const char *tmp, const char *dst_path, const char *name, const char *src_path,
+                        const struct stat *st, report_t *r, manifest_t *m, uint64_t path_hash,
+                        int err, int method, long long bytes) {
+    if (!err) err = install_file(tmp, dst_path, name, src_path, st, r, m, path_hash);
+    else unlink(tmp);
+    if (err) report_error(r, name, err);
+    else {
+        r->files_done++;
+        r->copied_by[method]++;
+        r->bytes_written += bytes;
+        if (m) manifest_record(m, path_hash, st);
+    }
+}
+
+// copy one regular file whose source stat is already known
+static void copy_regular(const char *src_path, const char *dst_path, const char *name, report_t *r,
+                         int delta, manifest_t *m, uint64_t path_hash, const struct stat *st) {
+    char tmp[PATH_LEN];
+    temp_name(dst_path, tmp, sizeof(tmp));
+    if (delta) {
+        long long written = 0, skipped = 0;
+        int in_place = 0;
+        int err = delta_file(src_path, dst_path, tmp, &written, &skipped, &in_place, r);
+        if (err >= 0) {
+            if (!err && !in_place) err = install_file(tmp, dst_path, name, src_path, st, r, NULL, 0);
+            if (err) report_error(r, name, err);
+            else r->files_done++;
+            r->bytes_written += written;
+            r->bytes_skipped += skipped;
+            return;
+        }
     }
+    int method = COPY_BUFFERED;
+    long long bytes = 0;
+    int err = copy_file(src_path, tmp, &method, &bytes, r);
+    finish_copy(tmp, dst_path, name, src_path, st, r, m, path_hash, err, method, bytes);
 }
+
+// with a manifest, a file whose source and target are as the last FULL sync
+// left them is counted unchanged and carried into the fresh manifest
+static int manifest_skip(manifest_t *m, uint64_t path_hash, const struct stat *st,
+                         const char *dst_path, report_t *r) {
+    struct stat dst_st;
+    if (!m || !manifest_unchanged(m, path_hash, st) || stat(dst_path, &dst_st) < 0
+        || !S_ISREG(dst_st.st_mode) || dst_st.st_size != st->st_size) return 0;
+    r->files_unchanged++;
+    r->bytes_skipped += st->st_size;
+    manifest_record(m, path_hash, st);
+    return 1;
 }
 
-void cleanup_resources() {
-    unlink("fss_in");
-    unlink("fss_out");
+// copy (or create, for directories) a single entry named relative to source;
+// with delta set an existing large target is patched instead of rewritten, with
+// a manifest a file whose source and target are unchanged since then is skipped
+static void sync_entry(const char *source, const char *target, const char *name, report_t *r,
+                       int delta, manifest_t *m) {
+    char src_path[PATH_LEN], dst_path[PATH_LEN];
+    snprintf(src_path, sizeof(src_path), "%s/%s", source, name);
+    snprintf(dst_path, sizeof(dst_path), "%s/%s", target, name);
+    struct stat st;
+    if (lstat(src_path, &st) < 0) { report_error(r, name, errno); return; }
+    if (S_ISDIR(st.st_mode)) {
+        if (mkdir(dst_path, st.st_mode & 0777) < 0 && errno != EEXIST)
+            report_error(r, name, errno);
+        return;
+    }
+    if (!S_ISREG(st.st_mode)) return;
+    uint64_t path_hash = m ? hash_path(name) : 0;
+    if (manifest_skip(m, path_hash, &st, dst_path, r)) return;
+    copy_regular(src_path, dst_path, name, r, delta, m, path_hash, &st);
 }
 
-// worker process count
-int worker_limit = 5;
-int current_worker_count = 0;
+// --- several targets ---
+// a pair may mirror its source into several targets; each changed file is
+// read from the source once and written to every target that needs it
+typedef struct targets {
+    int n;
+    const char *dir[MAX_TARGETS];
+    report_t *r[MAX_TARGETS];
+    manifest_t *m[MAX_TARGETS];   // NULL: no manifest
+} targets_t;
 
-// --- spawn_worker implementation ---
-void spawn_worker(const char *source, const char *target, const char *filename, const char *operation) {
-    if (current_worker_count >= worker_limit) {
-        char msg[256];
-        snprintf(msg, sizeof(msg), "Max worker limit reached. Task queued: %s", source);
-        log_message(msg);
-        enqueue_task(source, target, filename, operation);
+// split a task's target field in place; a single target reports straight
+// into r, several get a report each that close_targets() sums into r
+static void open_targets(targets_t *ts, char *list, report_t *r) {
+    static const char sep[] = { TARGET_SEP, '\0' };
+    memset(ts, 0, sizeof(*ts));
+    for (char *p = list; p && ts->n < MAX_TARGETS; )
+        ts->dir[ts->n++] = strsep(&p, sep);
+    if (ts->n == 1) {
+        ts->r[0] = r;
         return;
     }
-    int pipefd[2];
-    if (pipe(pipefd) < 0) {
-        perror("pipe");
+    r->targets = calloc(ts->n, sizeof(report_t));
+    r->target_count = ts->n;
+    for (int k = 0; k < ts->n; k++) {
+        report_init(&r->targets[k], r->operation);
+        r->targets[k].label = ts->dir[k];
+        r->targets[k].parent = r;
+        ts->r[k] = &r->targets[k];
+    }
+}
+
+static void close_targets(report_t *r) {
+    for (int k = 0; k < r->target_count; k++) {
+        report_merge(r, &r->targets[k]);
+        free(r->targets[k].results);
+    }
+}
+
+// a failure that is not any one target's counts against all of them
+static void targets_error(const targets_t *ts, const char *name, int err) {
+    for (int k = 0; k < ts->n; k++) report_error(ts->r[k], name, err);
+}
+
+static int targets_failed(const targets_t *ts) {
+    int failed = 0;
+    for (int k = 0; k < ts->n; k++) failed += ts->r[k]->files_failed;
+    return failed;
+}
+
+// one source file into several targets: targets it can be cloned to get a
+// reflink and no read at all; a single remaining target gets the usual
+// engines, two or more share one pass over the source through one buffer
+static void fan_out_copy(const char *src_path, const char *name, const struct stat *st,
+                         const targets_t *ts, uint64_t path_hash) {
+    int in = open(src_path, O_RDONLY);
+    struct stat in_st;
+    if (in < 0 || fstat(in, &in_st) < 0) {
+        targets_error(ts, name, errno);
+        if (in >= 0) close(in);
         return;
     }
-    pid_t pid = fork();
-    if (pid == 0) {
-        close(pipefd[0]);
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[1]);
-        execl("./worker", "worker", source, target, filename, operation, NULL);
-        perror("execl");
-        _exit(1);
-    } else if (pid > 0) {
-        close(pipefd[1]);
-        current_worker_count++;
-        add_worker_pipe(pid, pipefd[0], source);
-        char out[1024];
-        char tbuf[32];
-        current_time_str(tbuf, sizeof(tbuf));
-        snprintf(out, sizeof(out),
-            "%s Added directory: %s -> %s\n"
-            "%s Monitoring started for %s\n",
-            tbuf, source, target,
-            tbuf, source);
-        write(fifo_out_fd, out, strlen(out));
-    } else {
-        perror("fork");
+    char dst[MAX_TARGETS][PATH_LEN], tmp[MAX_TARGETS][PATH_LEN];
+    int out[MAX_TARGETS], err[MAX_TARGETS], method[MAX_TARGETS];
+    long long bytes[MAX_TARGETS];
+    fs_pair_t *pair[MAX_TARGETS];
+    int left = 0, last = -1;
+    for (int k = 0; k < ts->n; k++) {
+        snprintf(dst[k], PATH_LEN, "%s/%s", ts->dir[k], name);
+        temp_name(dst[k], tmp[k], PATH_LEN);
+        err[k] = 0;
+        method[k] = COPY_REFLINK;
+        bytes[k] = in_st.st_size;
+        struct stat out_st;
+        out[k] = open(tmp[k], O_WRONLY | O_CREAT | O_EXCL, in_st.st_mode & 0777);
+        if (out[k] < 0 || fstat(out[k], &out_st) < 0) { err[k] = errno; continue; }
+        pair[k] = lookup_fs_pair(in_st.st_dev, out_st.st_dev);
+        if (pair[k]->first == COPY_REFLINK) {
+            if (ioctl(out[k], FICLONE, in) == 0) continue;
+            if (!engine_unsupported(errno)) { err[k] = errno; continue; }
+            pair[k]->first = COPY_RANGE;
+        }
+        method[k] = -1;            // still to copy
+        left++;
+        last = k;
+    }
+    if (left == 1) {
+        err[last] = copy_engines(pair[last], in, out[last], in_st.st_size, &method[last], &bytes[last]);
+    } else if (left > 1) {
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+        char buf[COPY_BUF];
+        off_t off = 0;
+        int read_err = 0;
+        while (left) {
+            ssize_t got = pread(in, buf, sizeof(buf), off);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) { read_err = got < 0 ? errno : 0; break; }
+            // a target that fails to take a block drops out, the rest go on
+            for (int k = 0; k < ts->n; k++)
+                if (method[k] < 0 && !err[k] && write_all(out[k], buf, got) < 0) {
+                    err[k] = errno;
+                    left--;
+                }
+            off += got;
+        }
+        for (int k = 0; k < ts->n; k++)
+            if (method[k] < 0) {
+                method[k] = COPY_BUFFERED;
+                bytes[k] = off;
+                if (!err[k]) err[k] = read_err;
+            }
+    }
+    close(in);
+    for (int k = 0; k < ts->n; k++) {
+        if (out[k] < 0) { report_error(ts->r[k], name, err[k]); continue; }
+        if (!err[k] && fsync_policy == FSYNC_FILE) err[k] = timed_sync(out[k], 0, ts->r[k]);
+        if (close(out[k]) < 0 && !err[k]) err[k] = errno;
+        finish_copy(tmp[k], dst[k], name, src_path, st, ts->r[k], ts->m[k], path_hash,
+                    err[k], method[k], bytes[k]);
     }
 }
 
-// --- SIGCHLD handler ---
-void sigchld_handler(int signo) {
-    (void)signo;
-    int status;
-    pid_t pid;
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        current_worker_count--;
-        char msg[256];
-        snprintf(msg, sizeof(msg), "Worker %d finished.", pid);
-        log_message(msg);
-        process_task_queue();
+// sync_entry() into every target; delta patching only pays off with a
+// single target, so several that need a file share one read of it instead
+static void sync_entry_all(const char *source, const targets_t *ts, const char *name, int delta) {
+    if (ts->n == 1) {
+        sync_entry(source, ts->dir[0], name, ts->r[0], delta, ts->m[0]);
+        return;
+    }
+    char src_path[PATH_LEN], dst_path[PATH_LEN];
+    snprintf(src_path, sizeof(src_path), "%s/%s", source, name);
+    struct stat st;
+    if (lstat(src_path, &st) < 0) { targets_error(ts, name, errno); return; }
+    if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) return;
+    uint64_t path_hash = hash_path(name);
+    targets_t need = { 0 };
+    for (int k = 0; k < ts->n; k++) {
+        snprintf(dst_path, sizeof(dst_path), "%s/%s", ts->dir[k], name);
+        if (S_ISDIR(st.st_mode)) {
+            if (mkdir(dst_path, st.st_mode & 0777) < 0 && errno != EEXIST)
+                report_error(ts->r[k], name, errno);
+        } else if (!manifest_skip(ts->m[k], path_hash, &st, dst_path, ts->r[k])) {
+            need.dir[need.n] = ts->dir[k];
+            need.r[need.n] = ts->r[k];
+            need.m[need.n++] = ts->m[k];
+        }
+    }
+    if (need.n == 1) {
+        snprintf(dst_path, sizeof(dst_path), "%s/%s", need.dir[0], name);
+        copy_regular(src_path, dst_path, name, need.r[0], delta, need.m[0], path_hash, &st);
+    } else if (need.n > 1) {
+        fan_out_copy(src_path, name, &st, &need, path_hash);
     }
 }
 
-// --- main ---
-int main(int argc, char *argv[]) {
-    char *logfile     = NULL;
-    char *config_file = NULL;
-    int opt;
-    while ((opt = getopt(argc, argv, "l:c:n:")) != -1) {
-        switch(opt) {
-            case 'l': logfile     = optarg; break;
-            case 'c': config_file = optarg; break;
-            case 'n': worker_limit = atoi(optarg); break;
-            default:
-                fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> -n <worker_limit>\n", argv[0]);
-                exit(1);
-        }
-    }
-    if (!logfile || !config_file) {
-        fprintf(stderr, "Logfile and config_file required\n");
-        exit(1);
-    }
-
-    cleanup_resources();
-    log_fp = fopen(logfile, "a");
-    if (!log_fp) { perror("fopen log"); exit(1); }
-
-    struct sigaction sa = { .sa_handler = sigchld_handler };
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    sigaction(SIGCHLD, &sa, NULL);
-
-    if (mkfifo("fss_in", 0666) && errno != EEXIST) { perror("mkfifo in"); exit(1); }
-    if (mkfifo("fss_out",0666) && errno != EEXIST) { perror("mkfifo out"); exit(1); }
-
-    FILE *cf = fopen(config_file, "r");
-    if (!cf) { perror("open config"); exit(1); }
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), cf)) {
-        char src[256], dst[256];
-        if (sscanf(line, "%255s %255s", src, dst) != 2) continue;
-        if (find_sync_info(src)) {
-            char m[256];
-            snprintf(m,sizeof(m),"Source %s already registered. New target rejected.", src);
-            log_message(m);
+// depth-first removal of a target entry that may be a whole directory tree
+static int remove_tree(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) < 0) return errno == ENOENT ? 0 : -1;
+    if (!S_ISDIR(st.st_mode)) return unlink(path);
+    DIR *d = opendir(path);
+    if (!d) return -1;
+    struct dirent *de;
+    int err = 0;
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+        char sub[PATH_LEN];
+        snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+        if (remove_tree(sub) < 0 && !err) err = errno;
+    }
+    closedir(d);
+    if (err) { errno = err; return -1; }
+    return rmdir(path);
+}
+
+static void delete_entry(const char *target, const char *name, report_t *r) {
+    char dst_path[PATH_LEN];
+    snprintf(dst_path, sizeof(dst_path), "%s/%s", target, name);
+    int err = unlink(dst_path) == 0 || errno == ENOENT ? 0 : errno;
+    // a directory may still hold files its unwatched subtree lost on the source
+    if (err == EISDIR) err = remove_tree(dst_path) == 0 ? 0 : errno;
+    if (!err && fsync_policy == FSYNC_FILE) err = sync_parent(dst_path, r);
+    if (!err && fsync_policy == FSYNC_BATCH) note_unsynced(target);
+    if (err) report_error(r, name, err);
+    else r->files_done++;
+}
+
+// RESCAN: the manager lost track of the source (inotify overflow or a backlog
+// it stopped queueing), so DELETE events may be missing too. Only the top
+// level is watched, so only top-level target entries the source no longer
+// has are removed; they count as files done
+static void prune_target(const char *source, const char *target, report_t *r) {
+    struct stat st;
+    // a source that is gone or unreadable must not empty its target
+    if (stat(source, &st) < 0 || !S_ISDIR(st.st_mode)) return;
+    DIR *d = opendir(target);
+    if (!d) { report_error(r, target, errno); return; }
+    struct dirent *de;
+    int pruned = 0;
+    while ((de = readdir(d)) != NULL) {
+        // another worker's temp file is renamed into place any moment
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") || !strncmp(de->d_name, TMP_PREFIX, strlen(TMP_PREFIX))
+            || !strcmp(de->d_name, MANIFEST_NAME) || !strcmp(de->d_name, MANIFEST_TMP)) continue;
+        char src_path[PATH_LEN], dst_path[PATH_LEN];
+        snprintf(src_path, sizeof(src_path), "%s/%s", source, de->d_name);
+        if (lstat(src_path, &st) == 0 || errno != ENOENT) continue;
+        snprintf(dst_path, sizeof(dst_path), "%s/%s", target, de->d_name);
+        if (remove_tree(dst_path) == 0) { r->files_done++; pruned++; }
+        else report_error(r, de->d_name, errno);
+    }
+    closedir(d);
+    if (pruned && fsync_policy == FSYNC_FILE) {
+        int err = sync_dir(target, r);
+        if (err) report_error(r, target, err);
+    }
+    if (pruned && fsync_policy == FSYNC_BATCH) note_unsynced(target);
+}
+
+// --- io_uring batch copy ---
+// with -u, FULL sync threads copy small files URING_BATCH at a time: one
+// submission statx()es every source and target, a second runs a linked
+// open/read/open/write chain per file on fixed file slots, a third closes the
+// slots. Raw syscalls, no liburing; if the ring cannot be set up the files go
+// through sync_entry() one by one.
+#define URING_BATCH    32
+#define URING_MAX_FILE 65536           // larger files go through copy_file()
+#define URING_ENTRIES  256
+
+typedef struct uring {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void  *ring_map, *sqe_map;
+    size_t ring_len, sqe_len;
+    unsigned queued;           // SQEs filled since the last submit
+    char  *bufs;               // one URING_MAX_FILE buffer per file of a batch
+    char (*paths)[PATH_LEN];   // source and target path per file of a batch
+    char (*tmps)[PATH_LEN];    // temp file each target is written to
+} uring_t;
+
+static int use_uring = 0;                 // -u
+static __thread uring_t ring;
+static __thread int ring_state = 0;       // 0 = not tried, 1 = ready, -1 = unavailable
+
+static void uring_close(uring_t *u) {
+    if (u->sqe_map) munmap(u->sqe_map, u->sqe_len);
+    if (u->ring_map) munmap(u->ring_map, u->ring_len);
+    if (u->fd >= 0) close(u->fd);
+    free(u->bufs);
+    free(u->paths);
+    free(u->tmps);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+static int uring_setup(uring_t *u) {
+    memset(u, 0, sizeof(*u));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &p);
+    if (u->fd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP)) { uring_close(u); return -1; }
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_len = sq_len > cq_len ? sq_len : cq_len;
+    u->ring_map = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       u->fd, IORING_OFF_SQ_RING);
+    if (u->ring_map == MAP_FAILED) { u->ring_map = NULL; uring_close(u); return -1; }
+    u->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqe_map = mmap(NULL, u->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_SQES);
+    if (u->sqe_map == MAP_FAILED) { u->sqe_map = NULL; uring_close(u); return -1; }
+    char *base = u->ring_map;
+    u->sq_tail  = (unsigned *)(base + p.sq_off.tail);
+    u->sq_mask  = (unsigned *)(base + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(base + p.sq_off.array);
+    u->cq_head  = (unsigned *)(base + p.cq_off.head);
+    u->cq_tail  = (unsigned *)(base + p.cq_off.tail);
+    u->cq_mask  = (unsigned *)(base + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+    u->sqes     = u->sqe_map;
+    // sparse table of fixed file slots, a source and a target slot per file
+    struct io_uring_rsrc_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = 2 * URING_BATCH;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (syscall(SYS_io_uring_register, u->fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) < 0) {
+        uring_close(u);
+        return -1;
+    }
+    u->bufs = malloc((size_t)URING_BATCH * URING_MAX_FILE);
+    u->paths = malloc(2 * URING_BATCH * sizeof(*u->paths));
+    u->tmps = malloc(URING_BATCH * sizeof(*u->tmps));
+    if (!u->bufs || !u->paths || !u->tmps) { uring_close(u); return -1; }
+    return 0;
+}
+
+// only the owning thread touches the SQ tail, so it is published in uring_run()
+static struct io_uring_sqe *uring_sqe(uring_t *u, uint64_t user_data) {
+    unsigned idx = (*u->sq_tail + u->queued++) & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    u->sq_array[idx] = idx;
+    return sqe;
+}
+
+// submit everything queued and wait for one completion per SQE, storing each
+// result in res[user_data]; -1 leaves the ring unusable
+static int uring_run(uring_t *u, int *res) {
+    unsigned n = u->queued, done = 0, to_submit = n;
+    __atomic_store_n(u->sq_tail, *u->sq_tail + n, __ATOMIC_RELEASE);
+    u->queued = 0;
+    while (done < n) {
+        long ret = syscall(SYS_io_uring_enter, u->fd, to_submit, n - done, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+        unsigned head = *u->cq_head, tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, done++) {
+            struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+            res[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void uring_statx(uring_t *u, uint64_t user_data, const char *path, int flags, struct statx *sx) {
+    struct io_uring_sqe *sqe = uring_sqe(u, user_data);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)path;
+    sqe->len = STATX_BASIC_STATS;
+    sqe->statx_flags = flags;
+    sqe->off = (uintptr_t)sx;
+}
+
+static void uring_openat(uring_t *u, uint64_t user_data, const char *path, int flags, mode_t mode, unsigned slot) {
+    struct io_uring_sqe *sqe = uring_sqe(u, user_data);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)path;
+    sqe->open_flags = flags;
+    sqe->len = mode;
+    sqe->file_index = slot + 1;
+    sqe->flags = IOSQE_IO_LINK;
+}
+
+static void uring_rw(uring_t *u, uint64_t user_data, int opcode, unsigned slot, char *buf, unsigned len, int link) {
+    struct io_uring_sqe *sqe = uring_sqe(u, user_data);
+    sqe->opcode = opcode;
+    sqe->fd = slot;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = 0;
+    sqe->flags = IOSQE_FIXED_FILE | (link ? IOSQE_IO_LINK : 0);
+}
+
+static void uring_close_slot(uring_t *u, uint64_t user_data, unsigned slot) {
+    struct io_uring_sqe *sqe = uring_sqe(u, user_data);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+}
+
+// linked to the slot's close, which only runs once the data is on disk
+static void uring_fsync(uring_t *u, uint64_t user_data, unsigned slot) {
+    struct io_uring_sqe *sqe = uring_sqe(u, user_data);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = slot;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+}
+
+static void statx_to_stat(const struct statx *sx, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_mode = sx->stx_mode;
+    st->st_size = sx->stx_size;
+    st->st_ino  = sx->stx_ino;
+    st->st_mtim.tv_sec  = sx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = sx->stx_mtime.tv_nsec;
+}
+
+// sync up to URING_BATCH entries named relative to source, the same way
+// sync_entry() would, storing STATUS_SUCCESS or STATUS_ERROR per entry in
+// status when given; returns -1 without touching anything if io_uring is
+// unavailable to this thread
+static int uring_sync_files(const char *source, const char *target, char *const *names, int n,
+                            report_t *r, int delta, manifest_t *m, int *status) {
+    if (ring_state == 0) ring_state = uring_setup(&ring) == 0 ? 1 : -1;
+    if (ring_state < 0) return -1;
+    uring_t *u = &ring;
+    struct statx sx[2 * URING_BATCH], after[URING_BATCH];
+    struct stat st[URING_BATCH];
+    uint64_t hashes[URING_BATCH];
+    int copy[URING_BATCH];
+    int res[8 * URING_BATCH];  // statx and chains: 4 per file, then 2 closes, a statx and an fsync
+    int mark[URING_BATCH + 1]; // r->files_failed as each file's first pass began
+    int bad[URING_BATCH];
+
+    for (int i = 0; i < n; i++) {
+        snprintf(u->paths[2 * i], PATH_LEN, "%s/%s", source, names[i]);
+        snprintf(u->paths[2 * i + 1], PATH_LEN, "%s/%s", target, names[i]);
+        temp_name(u->paths[2 * i + 1], u->tmps[i], PATH_LEN);
+        uring_statx(u, 2 * i, u->paths[2 * i], AT_SYMLINK_NOFOLLOW, &sx[2 * i]);
+        uring_statx(u, 2 * i + 1, u->paths[2 * i + 1], 0, &sx[2 * i + 1]);
+    }
+    if (uring_run(u, res) < 0) {
+        for (int i = 0; i < n; i++) {
+            copy[i] = 1;
+            bad[i] = 0;
+        }
+        goto broken;
+    }
+
+    int chains = 0;
+    for (int i = 0; i < n; i++) {
+        copy[i] = 0;
+        mark[i] = r->files_failed;
+        if (res[2 * i] < 0) { report_error(r, names[i], -res[2 * i]); continue; }
+        statx_to_stat(&sx[2 * i], &st[i]);
+        if (S_ISDIR(st[i].st_mode)) { sync_entry(source, target, names[i], r, 0, NULL); continue; }
+        if (!S_ISREG(st[i].st_mode)) continue;
+        hashes[i] = m ? hash_path(names[i]) : 0;
+        if (m && manifest_unchanged(m, hashes[i], &st[i]) && res[2 * i + 1] == 0
+            && S_ISREG(sx[2 * i + 1].stx_mode) && sx[2 * i + 1].stx_size == sx[2 * i].stx_size) {
+            r->files_unchanged++;
+            r->bytes_skipped += st[i].st_size;
+            manifest_record(m, hashes[i], &st[i]);
+            continue;
+        }
+        if (st[i].st_size > URING_MAX_FILE) {
+            copy_regular(u->paths[2 * i], u->paths[2 * i + 1], names[i], r, delta, m, hashes[i], &st[i]);
             continue;
         }
-        add_sync_info(src, dst);
-        spawn_worker(src, dst, "ALL", "FULL");
+        // a short read (the file changed) breaks the link, so the temp file
+        // is never created unless the whole source was read
+        char *buf = u->bufs + (size_t)i * URING_MAX_FILE;
+        unsigned size = st[i].st_size;
+        uring_openat(u, 4 * i, u->paths[2 * i], O_RDONLY, 0, 2 * i);
+        uring_rw(u, 4 * i + 1, IORING_OP_READ, 2 * i, buf, size, 1);
+        uring_openat(u, 4 * i + 2, u->tmps[i], O_WRONLY | O_CREAT | O_EXCL, st[i].st_mode & 0777, 2 * i + 1);
+        uring_rw(u, 4 * i + 3, IORING_OP_WRITE, 2 * i + 1, buf, size, 0);
+        copy[i] = 1;
+        chains++;
+    }
+    mark[n] = r->files_failed;
+    for (int i = 0; i < n; i++) bad[i] = mark[i + 1] > mark[i];
+    if (!chains) goto done;
+    if (uring_run(u, res) < 0) goto broken;
+
+    int fsyncs = 0;
+    for (int i = 0; i < n; i++) {
+        if (!copy[i]) continue;
+        res[7 * URING_BATCH + i] = 0;
+        if (res[4 * i] >= 0) uring_close_slot(u, 4 * URING_BATCH + 2 * i, 2 * i);
+        if (res[4 * i + 2] >= 0 && fsync_policy == FSYNC_FILE && res[4 * i + 3] == st[i].st_size) {
+            uring_fsync(u, 7 * URING_BATCH + i, 2 * i + 1);
+            fsyncs++;
+        }
+        if (res[4 * i + 2] >= 0) uring_close_slot(u, 4 * URING_BATCH + 2 * i + 1, 2 * i + 1);
+        // a write that lands between the first statx and the read is only
+        // seen by looking again once the copy is done
+        uring_statx(u, 6 * URING_BATCH + i, u->paths[2 * i], AT_SYMLINK_NOFOLLOW, &after[i]);
+    }
+    // the fsyncs dominate this round, so it is what they are charged
+    long long start = mono_ns();
+    if (uring_run(u, res) < 0) goto broken;
+    if (fsyncs) {
+        r->fsyncs += fsyncs;
+        r->fsync_ns += mono_ns() - start;
     }
-    fclose(cf);
 
-    inotify_fd = inotify_init();
-    for (sync_info_t *si = sync_info_head; si; si = si->next) {
-        int wd = inotify_add_watch(inotify_fd, si->source_dir, IN_CREATE|IN_MODIFY|IN_DELETE);
-        if (wd < 0) perror("inotify_add_watch");
+    for (int i = 0; i < n; i++) {
+        if (!copy[i]) continue;
+        int before = r->files_failed, err;
+        long long size = st[i].st_size;
+        if (res[4 * i] < 0)
+            report_error(r, names[i], -res[4 * i]);
+        else if (res[4 * i + 1] != size || (res[4 * i + 2] >= 0 && res[4 * i + 3] != size)
+                 || (res[6 * URING_BATCH + i] == 0 && (after[i].stx_size != sx[2 * i].stx_size
+                     || after[i].stx_mtime.tv_sec != sx[2 * i].stx_mtime.tv_sec
+                     || after[i].stx_mtime.tv_nsec != sx[2 * i].stx_mtime.tv_nsec))) {
+            // changed while being copied, or a short write: the regular path redoes it
+            unlink(u->tmps[i]);
+            sync_entry(source, target, names[i], r, delta, m);
+        } else if (res[4 * i + 2] < 0)
+            report_error(r, names[i], -res[4 * i + 2]);
+        else if (res[7 * URING_BATCH + i] < 0) {
+            unlink(u->tmps[i]);
+            report_error(r, names[i], -res[7 * URING_BATCH + i]);
+        } else if ((err = install_file(u->tmps[i], u->paths[2 * i + 1], names[i], u->paths[2 * i],
+                                        &st[i], r, m, hashes[i])))
+            report_error(r, names[i], err);
         else {
-            si->inotify_watch = wd;
-            char m[256];
-            snprintf(m,sizeof(m),"Monitoring started for %s", si->source_dir);
-            log_message(m);
-        }
-    }
-
-    int fifo_in_fd  = open("fss_in", O_RDONLY | O_NONBLOCK);
-    if (fifo_in_fd < 0) { perror("open fss_in"); exit(1); }
-    int flags = fcntl(fifo_in_fd, F_GETFL, 0);
-    fcntl(fifo_in_fd, F_SETFL, flags & ~O_NONBLOCK);
-
-    int fifo_out_fd;
-    do {
-        fifo_out_fd = open("fss_out", O_WRONLY | O_NONBLOCK);
-        if (fifo_out_fd < 0 && (errno==ENXIO||errno==ENOENT)) usleep(100000);
-    } while (fifo_out_fd < 0);
-
-    char buf[1024];
-    int running = 1;
-    while (running) {
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(inotify_fd,  &rfds);
-        FD_SET(fifo_in_fd,  &rfds);
-        int maxfd = inotify_fd > fifo_in_fd ? inotify_fd : fifo_in_fd;
-        for (worker_pipe_t *wp=worker_pipes; wp; wp=wp->next) {
-            FD_SET(wp->fd,&rfds);
-            if (wp->fd > maxfd) maxfd = wp->fd;
-        }
-        maxfd++;
-
-        if (select(maxfd, &rfds, NULL, NULL, NULL) < 0) {
-            if (errno==EINTR) continue;
-            perror("select");
-            break;
+            r->files_done++;
+            r->copied_by[COPY_URING]++;
+            r->bytes_written += size;
+            if (m) manifest_record(m, hashes[i], &st[i]);
+        }
+        bad[i] = r->files_failed > before;
+    }
+done:
+    if (status)
+        for (int i = 0; i < n; i++) status[i] = bad[i] ? STATUS_ERROR : STATUS_SUCCESS;
+    return 0;
+
+broken:
+    // the unfinished files' results are unknown; the regular path redoes them,
+    // which is harmless for anything the ring already copied
+    for (int i = 0; i < n; i++)
+        if (copy[i]) unlink(u->tmps[i]);
+    uring_close(u);
+    ring_state = -1;
+    for (int i = 0; i < n; i++) {
+        if (!copy[i]) continue;
+        int before = r->files_failed;
+        sync_entry(source, target, names[i], r, delta, m);
+        bad[i] = r->files_failed > before;
+    }
+    goto done;
+}
+
+// --- verify ---
+// VERIFY reads every source file and its copy in each target and compares
+// their CRC32C. The SSE4.2 crc32 instruction takes 8 bytes a step where the
+// CPU has it, a slice-by-8 table does it elsewhere
+static uint32_t crc32c_table[8][256];
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+    crc = ~crc;
+    for (; len && ((uintptr_t)p & 7); len--) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);                  // little-endian
+        v ^= crc;
+        crc = crc32c_table[7][v & 0xff]         ^ crc32c_table[6][(v >> 8) & 0xff]
+            ^ crc32c_table[5][(v >> 16) & 0xff] ^ crc32c_table[4][(v >> 24) & 0xff]
+            ^ crc32c_table[3][(v >> 32) & 0xff] ^ crc32c_table[2][(v >> 40) & 0xff]
+            ^ crc32c_table[1][(v >> 48) & 0xff] ^ crc32c_table[0][v >> 56];
+    }
+    for (; len; len--) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = ~crc;
+    for (; len && ((uintptr_t)p & 7); len--) c = _mm_crc32_u8((uint32_t)c, *p++);
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    for (; len; len--) c = _mm_crc32_u8((uint32_t)c, *p++);
+    return ~(uint32_t)c;
+}
+#endif
+
+static uint32_t (*crc32c)(uint32_t crc, const unsigned char *p, size_t len) = crc32c_sw;
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+        crc32c_table[0][i] = c;
+    }
+    for (int t = 1; t < 8; t++)
+        for (int i = 0; i < 256; i++)
+            crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xff];
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) crc32c = crc32c_hw;
+#endif
+}
+
+// CRC32C of a whole file, VERIFY_BUF at a time: the next chunk is asked for
+// before this one is hashed, and hashed chunks leave the page cache so a
+// scrub of a large tree does not push out everything else
+static int hash_file(const char *path, char *buf, uint32_t *crc, long long *bytes) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    uint32_t c = 0;
+    off_t off = 0;
+    ssize_t got;
+    int err;
+    while (!(err = read_block(fd, buf, VERIFY_BUF, off, &got)) && got > 0) {
+        posix_fadvise(fd, off + got, VERIFY_BUF, POSIX_FADV_WILLNEED);
+        c = crc32c(c, (const unsigned char *)buf, got);
+        posix_fadvise(fd, off, got, POSIX_FADV_DONTNEED);
+        off += got;
+    }
+    close(fd);
+    *crc = c;
+    *bytes += off;
+    return err;
+}
+
+// compare one source file with its copy in every target; the source is
+// hashed once, and only for targets whose copy has the right size. A file
+// that changed while it was read is left to the task its change queued.
+// Each file that differs somewhere is listed in ts->r[0] with the operation
+// that repairs it
+static void verify_entry(const char *source, const targets_t *ts, const char *name, char *buf) {
+    enum { SAME, MISSING, DIFFERS, FAILED };
+    char src_path[PATH_LEN], dst_path[PATH_LEN];
+    snprintf(src_path, sizeof(src_path), "%s/%s", source, name);
+    struct stat st, dst_st;
+    if (lstat(src_path, &st) < 0) { targets_error(ts, name, errno); return; }
+    if (!S_ISREG(st.st_mode)) return;
+    int state[MAX_TARGETS];
+    uint32_t src_crc = 0, dst_crc;
+    int hashed = 0, err;
+    for (int k = 0; k < ts->n; k++) {
+        report_t *r = ts->r[k];
+        snprintf(dst_path, sizeof(dst_path), "%s/%s", ts->dir[k], name);
+        state[k] = SAME;
+        if (lstat(dst_path, &dst_st) < 0) {
+            if (errno == ENOENT) state[k] = MISSING;
+            else { report_error(r, name, errno); state[k] = FAILED; }
+            continue;
         }
+        if (!S_ISREG(dst_st.st_mode) || dst_st.st_size != st.st_size) { state[k] = DIFFERS; continue; }
+        if (!hashed && (err = hash_file(src_path, buf, &src_crc, &r->bytes_read))) {
+            for (int j = 0; j < ts->n; j++)
+                if (j >= k || state[j] != FAILED) report_error(ts->r[j], name, err);
+            return;
+        }
+        hashed = 1;
+        if ((err = hash_file(dst_path, buf, &dst_crc, &r->bytes_read))) {
+            report_error(r, name, err);
+            state[k] = FAILED;
+            continue;
+        }
+        if (dst_crc != src_crc) state[k] = DIFFERS;
+    }
+    if (hashed && source_changed(src_path, &st)) return;
+    int repair = -1;
+    for (int k = 0; k < ts->n; k++) {
+        if (state[k] == SAME) ts->r[k]->files_done++;
+        else if (state[k] == MISSING) report_line(ts->r[k], name, "missing on target");
+        else if (state[k] == DIFFERS) report_line(ts->r[k], name, "differs from source");
+        if (state[k] == DIFFERS) repair = OP_MODIFIED;
+        else if (state[k] == MISSING && repair < 0) repair = OP_ADDED;
+    }
+    if (repair >= 0 && ts->r[0]->results_len < RESULTS_MAX)
+        report_file(ts->r[0], name, repair, STATUS_ERROR);
+}
 
-        if (FD_ISSET(inotify_fd, &rfds)) {
-            char evbuf[EVENT_BUF_LEN];
-            int len = read(inotify_fd, evbuf, sizeof(evbuf));
-            for (int i=0; i<len; ) {
-                struct inotify_event *e = (void*)(evbuf+i);
-                for (sync_info_t *si=sync_info_head; si; si=si->next) {
-                    if (si->inotify_watch==e->wd && e->len) {
-                        const char *op = NULL;
-                        if (e->mask&IN_CREATE) op="ADDED";
-                        if (e->mask&IN_MODIFY) op="MODIFIED";
-                        if (e->mask&IN_DELETE) op="DELETED";
-                        if (op) spawn_worker(si->source_dir, si->target_dir, e->name, op);
-                    }
+// the other half of a VERIFY: what target k has under rel and the source does
+// not. Each such entry is listed once, for the first target that has it, to be
+// DELETED; a directory the source lacks is one entry and is not descended into
+static void verify_target_only(const char *source, const targets_t *ts, int k, const char *rel) {
+    char dir[PATH_LEN];
+    snprintf(dir, sizeof(dir), "%s%s%s", ts->dir[k], *rel ? "/" : "", rel);
+    DIR *d = opendir(dir);
+    if (!d) {
+        // a missing target was reported file by file from the source side
+        if (errno != ENOENT) report_error(ts->r[k], *rel ? rel : ts->dir[k], errno);
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+        if (!*rel && (!strcmp(de->d_name, MANIFEST_NAME) || !strcmp(de->d_name, MANIFEST_TMP))) continue;
+        if (!strncmp(de->d_name, TMP_PREFIX, strlen(TMP_PREFIX))) continue;
+        char name[PATH_LEN], path[PATH_LEN];
+        int n = snprintf(name, sizeof(name), "%s%s%s", rel, *rel ? "/" : "", de->d_name);
+        if (n >= (int)sizeof(name)
+            || snprintf(path, sizeof(path), "%s/%s", source, name) >= (int)sizeof(path)) {
+            report_error(ts->r[k], de->d_name, ENAMETOOLONG);
+            continue;
+        }
+        struct stat st;
+        if (lstat(path, &st) == 0) {
+            // a type mismatch is the source side's to report
+            if (S_ISDIR(st.st_mode)) {
+                int is_dir = de->d_type == DT_DIR;
+                if (de->d_type == DT_UNKNOWN) {
+                    is_dir = snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) < (int)sizeof(path)
+                             && lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
                 }
-                i += EVENT_SIZE + e->len;
+                if (is_dir) verify_target_only(source, ts, k, name);
             }
+            continue;
+        }
+        if (errno != ENOENT) { report_error(ts->r[k], name, errno); continue; }
+        report_line(ts->r[k], name, "not in source");
+        int listed = 0;
+        for (int j = 0; j < k && !listed; j++)
+            listed = snprintf(path, sizeof(path), "%s/%s", ts->dir[j], name) < (int)sizeof(path)
+                     && lstat(path, &st) == 0;
+        if (!listed && ts->r[0]->results_len < RESULTS_MAX)
+            report_file(ts->r[0], name, OP_DELETED, STATUS_ERROR);
+    }
+    closedir(d);
+}
+
+// --- parallel FULL traversal ---
+// every thread owns a deque of directories still to scan and files still to
+// copy; it works LIFO on its own deque and, when that runs dry, steals the
+// oldest (usually largest) item from another thread's deque
+typedef struct work_item {
+    int   is_dir;
+    char *rel;                 // path relative to source, "" for the root
+} work_item_t;
+
+typedef struct work_deque {
+    pthread_mutex_t lock;
+    work_item_t *items;        // circular, live items are [head, head + count)
+    size_t cap, head, count;
+} work_deque_t;
+
+typedef struct full_sync full_sync_t;
+
+typedef struct full_thread {
+    full_sync_t *fs;
+    pthread_t tid;
+    work_deque_t dq;
+    report_t *r;               // per-thread counters per target, merged at the end
+    manifest_t *m;             // per target: shares the old manifest, own fresh entries
+    targets_t ts;              // the task's targets with this thread's r and m
+    unsigned seed;
+} full_thread_t;
+
+struct full_sync {
+    const char *source;
+    const targets_t *ts;
+    int verify;                // VERIFY: hash and compare instead of copying
+    int nthreads;
+    full_thread_t *threads;
+    atomic_long pending;       // items pushed but not yet finished
+};
+
+static int full_threads = 0;   // -j, one per online CPU when not given
+
+static void deque_push(work_deque_t *dq, work_item_t it) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        size_t cap = dq->cap ? dq->cap * 2 : 256;
+        work_item_t *items = malloc(cap * sizeof(work_item_t));
+        for (size_t i = 0; i < dq->count; i++)
+            items[i] = dq->items[(dq->head + i) % dq->cap];
+        free(dq->items);
+        dq->items = items;
+        dq->cap = cap;
+        dq->head = 0;
+    }
+    dq->items[(dq->head + dq->count++) % dq->cap] = it;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+// owner end: newest item
+static int deque_pop(work_deque_t *dq, work_item_t *it) {
+    pthread_mutex_lock(&dq->lock);
+    int ok = dq->count > 0;
+    if (ok) *it = dq->items[(dq->head + --dq->count) % dq->cap];
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+// thief end: oldest item
+static int deque_steal(work_deque_t *dq, work_item_t *it) {
+    if (pthread_mutex_trylock(&dq->lock) != 0) return 0;
+    int ok = dq->count > 0;
+    if (ok) {
+        *it = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+static void push_work(full_thread_t *t, int is_dir, const char *rel) {
+    work_item_t it = { is_dir, strdup(rel) };
+    atomic_fetch_add(&t->fs->pending, 1);
+    deque_push(&t->dq, it);
+}
+
+static int steal_work(full_thread_t *t, work_item_t *it) {
+    full_sync_t *fs = t->fs;
+    int start = rand_r(&t->seed) % fs->nthreads;
+    for (int i = 0; i < fs->nthreads; i++) {
+        full_thread_t *victim = &fs->threads[(start + i) % fs->nthreads];
+        if (victim != t && deque_steal(&victim->dq, it)) return 1;
+    }
+    return 0;
+}
+
+// a temp file that a worker killed mid-copy left behind. Its writer thread is
+// gone, and has been for a while since tids are reused, or nothing has written
+// it for an hour
+static int stale_temp(const char *path, const char *name) {
+    struct stat st;
+    if (lstat(path, &st) < 0 || !S_ISREG(st.st_mode)) return 0;
+    time_t idle = time(NULL) - st.st_mtime;
+    if (idle >= TMP_ABANDON_SEC) return 1;
+    long tid = strtol(name + strlen(TMP_PREFIX), NULL, 10);
+    return idle >= TMP_GRACE_SEC && tid > 0 && kill(tid, 0) < 0 && errno == ESRCH;
+}
+
+// FULL: remove the stale temp files from rel in every target; a live one is
+// renamed into place any moment, so it is left alone
+static void sweep_temps(full_thread_t *t, const char *rel) {
+    for (int k = 0; k < t->ts.n; k++) {
+        char dir[PATH_LEN], path[PATH_LEN];
+        if (snprintf(dir, sizeof(dir), "%s%s%s", t->ts.dir[k], *rel ? "/" : "", rel) >= (int)sizeof(dir)) continue;
+        DIR *d = opendir(dir);
+        if (!d) continue;
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (strncmp(de->d_name, TMP_PREFIX, strlen(TMP_PREFIX))
+                || snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int)sizeof(path)
+                || !stale_temp(path, de->d_name)) continue;
+            if (unlink(path) < 0 && errno != ENOENT) report_error(t->ts.r[k], de->d_name, errno);
+        }
+        closedir(d);
+    }
+}
+
+// scan one directory: subdirectories are created on the target right away so
+// that files found in them later always have a parent to land in, unless
+// this is only a VERIFY
+static void scan_dir(full_thread_t *t, const char *rel) {
+    full_sync_t *fs = t->fs;
+    char src_dir[PATH_LEN];
+    snprintf(src_dir, sizeof(src_dir), "%s%s%s", fs->source, *rel ? "/" : "", rel);
+    DIR *d = opendir(src_dir);
+    if (!d) { targets_error(&t->ts, *rel ? rel : fs->source, errno); return; }
+    if (!fs->verify) sweep_temps(t, rel);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+        // a source that is itself some pair's target carries that pair's
+        // manifest, and temp files of its workers
+        if (!*rel && (!strcmp(de->d_name, MANIFEST_NAME) || !strcmp(de->d_name, MANIFEST_TMP))) continue;
+        if (!strncmp(de->d_name, TMP_PREFIX, strlen(TMP_PREFIX))) continue;
+        // a truncated path would name some other file, so it is skipped
+        char name[PATH_LEN], path[PATH_LEN];
+        int n = snprintf(name, sizeof(name), "%s%s%s", rel, *rel ? "/" : "", de->d_name);
+        if (n >= (int)sizeof(name)
+            || snprintf(path, sizeof(path), "%s/%s", fs->source, name) >= (int)sizeof(path)) {
+            targets_error(&t->ts, de->d_name, ENAMETOOLONG);
+            continue;
         }
+        int is_dir = de->d_type == DT_DIR;
+        if (de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir && !fs->verify) sync_entry_all(fs->source, &t->ts, name, 0);
+        push_work(t, is_dir, name);
+    }
+    closedir(d);
+}
+
+// files held back for one io_uring batch stay pending until it is done, so no
+// thread can finish while another still owns unsynced files; only pairs with
+// a single target batch
+static void flush_batch(full_thread_t *t, char **batch, int *nbatch) {
+    full_sync_t *fs = t->fs;
+    if (uring_sync_files(fs->source, t->ts.dir[0], batch, *nbatch, t->ts.r[0], 0, t->ts.m[0], NULL) < 0)
+        for (int i = 0; i < *nbatch; i++)
+            sync_entry_all(fs->source, &t->ts, batch[i], 0);
+    for (int i = 0; i < *nbatch; i++) free(batch[i]);
+    atomic_fetch_sub(&fs->pending, *nbatch);
+    *nbatch = 0;
+}
 
-        if (FD_ISSET(fifo_in_fd, &rfds)) {
-            int n = read(fifo_in_fd, buf, sizeof(buf)-1);
-            if (n>0) {
-                buf[n]='\0';
-                char cmd[16], a1[256], a2[256];
-                sscanf(buf,"%15s %255s %255s",cmd,a1,a2);
-                char tbuf[32], out[1024];
-                if (!strcmp(cmd,"add")) {
-                    if (find_sync_info(a1)) {
-                        current_time_str(tbuf,sizeof(tbuf));
-                        snprintf(out,sizeof(out),"%s Already in queue: %s\n", tbuf, a1);
-                        write(fifo_out_fd,out,strlen(out));
-                    } else {
-                        add_sync_info(a1,a2);
-                        spawn_worker(a1,a2,"ALL","FULL");
-                        current_time_str(tbuf,sizeof(tbuf));
-                        snprintf(out,sizeof(out),
-                            "%s Added directory: %s -> %s\n"
-                            "%s Monitoring started for %s\n",
-                            tbuf, a1, a2,
-                            tbuf, a1);
-                        write(fifo_out_fd,out,strlen(out));
-                    }
+static void *full_thread_main(void *arg) {
+    full_thread_t *t = arg;
+    work_item_t it;
+    char *batch[URING_BATCH];
+    int nbatch = 0;
+    int idle = 0;
+    char *hash_buf = t->fs->verify ? malloc(VERIFY_BUF) : NULL;
+    for (;;) {
+        if (deque_pop(&t->dq, &it) || steal_work(t, &it)) {
+            idle = 0;
+            if (!it.is_dir && use_uring && t->ts.n == 1 && !t->fs->verify) {
+                batch[nbatch++] = it.rel;
+                if (nbatch == URING_BATCH) flush_batch(t, batch, &nbatch);
+                continue;
+            }
+            if (it.is_dir) scan_dir(t, it.rel);
+            else if (t->fs->verify) verify_entry(t->fs->source, &t->ts, it.rel, hash_buf);
+            else sync_entry_all(t->fs->source, &t->ts, it.rel, 0);
+            free(it.rel);
+            atomic_fetch_sub(&t->fs->pending, 1);
+            maybe_flush_staged();
+            continue;
+        }
+        if (nbatch) { flush_batch(t, batch, &nbatch); maybe_flush_staged(); continue; }
+        if (atomic_load(&t->fs->pending) == 0) break;
+        // someone is still scanning or copying and may publish more work
+        if (++idle < 64) sched_yield();
+        else nanosleep(&(struct timespec){ 0, 200000 }, NULL);
+    }
+    free(hash_buf);
+    flush_staged(t->ts.r[0]);
+    if (ring_state > 0) uring_close(&ring);
+    ring_state = 0;
+    return NULL;
+}
+
+// copy every regular file under source into each target with full_threads
+// threads; every target has its manifest in ts->m. With verify the same
+// threads compare instead, and there are no manifests
+static void sync_full(const char *source, const targets_t *ts, int verify) {
+    full_sync_t fs = { source, ts, verify, full_threads, NULL, 0 };
+    fs.threads = calloc(fs.nthreads, sizeof(full_thread_t));
+    for (int i = 0; i < fs.nthreads; i++) {
+        full_thread_t *t = &fs.threads[i];
+        t->fs = &fs;
+        pthread_mutex_init(&t->dq.lock, NULL);
+        t->r = calloc(ts->n, sizeof(report_t));
+        t->m = calloc(ts->n, sizeof(manifest_t));
+        t->ts.n = ts->n;
+        for (int k = 0; k < ts->n; k++) {
+            t->r[k].operation = ts->r[k]->operation;
+            t->r[k].label = ts->r[k]->label;
+            t->ts.dir[k] = ts->dir[k];
+            t->ts.r[k] = &t->r[k];
+            if (!ts->m[k]) continue;
+            t->m[k].old = ts->m[k]->old;
+            t->m[k].old_count = ts->m[k]->old_count;
+            t->ts.m[k] = &t->m[k];
+        }
+        t->seed = i + 1;
+    }
+    push_work(&fs.threads[0], 1, "");
+    int started = 1;
+    for (; started < fs.nthreads; started++)
+        if (pthread_create(&fs.threads[started].tid, NULL, full_thread_main, &fs.threads[started]) != 0)
+            break;
+    // a thread that failed to start never owns work, so its empty deque is harmless
+    full_thread_main(&fs.threads[0]);
+    for (int i = 1; i < started; i++)
+        pthread_join(fs.threads[i].tid, NULL);
+
+    for (int i = 0; i < fs.nthreads; i++) {
+        full_thread_t *t = &fs.threads[i];
+        for (int k = 0; k < ts->n; k++) {
+            manifest_t *m = ts->m[k];
+            report_merge(ts->r[k], &t->r[k]);
+            free(t->r[k].results);
+            for (size_t e = 0; e < t->m[k].fresh_count; e++) {
+                if (m->fresh_count == m->fresh_cap) {
+                    m->fresh_cap = m->fresh_cap ? m->fresh_cap * 2 : 1024;
+                    m->fresh = realloc(m->fresh, m->fresh_cap * sizeof(manifest_entry_t));
                 }
-                // … (rest commands unchanged) …
+                m->fresh[m->fresh_count++] = t->m[k].fresh[e];
             }
+            free(t->m[k].fresh);
+        }
+        free(t->r);
+        free(t->m);
+        free(t->dq.items);
+        pthread_mutex_destroy(&t->dq.lock);
+    }
+    for (int k = 0; k < ts->n; k++) ts->r[k]->threads = started;
+    free(fs.threads);
+}
+
+// target is the task's target field: one directory, or several joined by
+// TARGET_SEP
+static void run_task(const char *source, const char *target, const char *filename, const char *operation) {
+    report_t r;
+    report_init(&r, op_from_name(operation));
+    char *list = strdup(target);
+    targets_t ts;
+    open_targets(&ts, list, &r);
+    if (r.operation == OP_FULL) {
+        // a target that cannot be created is left out, the others go on
+        manifest_t m[MAX_TARGETS];
+        targets_t live = { 0 };
+        for (int k = 0; k < ts.n; k++) {
+            if (mkdir(ts.dir[k], 0755) < 0 && errno != EEXIST) { report_error(ts.r[k], ts.dir[k], errno); continue; }
+            manifest_open(&m[live.n], ts.dir[k]);
+            live.dir[live.n] = ts.dir[k];
+            live.r[live.n] = ts.r[k];
+            live.m[live.n] = &m[live.n];
+            live.n++;
         }
+        if (live.n) sync_full(source, &live, 0);
+        for (int k = 0; k < live.n; k++) {
+            if (!strcmp(filename, "RESCAN")) prune_target(source, live.dir[k], live.r[k]);
+            int err = manifest_commit(live.m[k], live.dir[k], live.r[k]);
+            if (err) report_error(live.r[k], MANIFEST_NAME, err);
+            manifest_close(live.m[k]);
+        }
+    } else if (r.operation == OP_VERIFY) {
+        // filename is ALL or REPAIR: the manager acts on the list, not the worker
+        sync_full(source, &ts, 1);
+        // a source that is gone or unreadable would make everything extra
+        struct stat st;
+        if (stat(source, &st) == 0 && S_ISDIR(st.st_mode))
+            for (int k = 0; k < ts.n; k++) verify_target_only(source, &ts, k, "");
+    } else if (r.operation == OP_ADDED || r.operation == OP_MODIFIED) {
+        sync_entry_all(source, &ts, filename, r.operation == OP_MODIFIED);
+    } else if (r.operation == OP_DELETED) {
+        for (int k = 0; k < ts.n; k++) delete_entry(ts.dir[k], filename, ts.r[k]);
+    } else {
+        targets_error(&ts, filename, EINVAL);
+    }
+    flush_staged(&r);
+    close_targets(&r);
+    print_report(&r);
+    free(r.results);
+    free(r.targets);
+    free(list);
+}
 
-        // … (worker pipes handling, shutdown, etc.) …
+// run a BATCH for one sync pair and send one report with a result per file;
+// with -u runs of copies to a single target go through io_uring, URING_BATCH
+// files at a time
+static void run_batch(const char *source, const char *target, char **names, int *ops, int n) {
+    report_t r;
+    report_init(&r, OP_BATCH);
+    char *list = strdup(target);
+    targets_t ts;
+    open_targets(&ts, list, &r);
+    int uring = use_uring && ts.n == 1;
+    int status[URING_BATCH];
+    for (int i = 0; i < n; ) {
+        int copy = ops[i] == OP_ADDED || ops[i] == OP_MODIFIED;
+        int run = 1;
+        // consecutive copies with the same operation share a ring submission
+        if (copy && uring)
+            while (i + run < n && run < URING_BATCH && ops[i + run] == ops[i]) run++;
+        if (copy && uring
+            && uring_sync_files(source, ts.dir[0], names + i, run, &r, ops[i] == OP_MODIFIED, NULL, status) == 0) {
+            for (int k = 0; k < run; k++) report_file(&r, names[i + k], ops[i], status[k]);
+            i += run;
+            maybe_flush_staged();
+            continue;
+        }
+        int before = targets_failed(&ts);
+        if (copy) sync_entry_all(source, &ts, names[i], ops[i] == OP_MODIFIED);
+        else if (ops[i] == OP_DELETED)
+            for (int k = 0; k < ts.n; k++) delete_entry(ts.dir[k], names[i], ts.r[k]);
+        else targets_error(&ts, names[i], EINVAL);
+        report_file(&r, names[i], ops[i], targets_failed(&ts) > before ? STATUS_ERROR : STATUS_SUCCESS);
+        i++;
+        maybe_flush_staged();
     }
+    flush_staged(&r);
+    close_targets(&r);
+    print_report(&r);
+    free(r.results);
+    free(r.targets);
+    free(list);
+}
 
-    // cleanup shutdown …
+// a "<filename>\t<operation>" line of a BATCH, split in place
+static int parse_batch_line(char *line, char **name, int *op) {
+    size_t len = strlen(line);
+    if (len && line[len - 1] == '\n') line[--len] = '\0';
+    char *tab = strrchr(line, '\t');
+    if (!tab) return -1;
+    *tab = '\0';
+    *name = line;
+    *op = op_from_name(tab + 1);
+    return 0;
+}
+
+// reads the count lines that follow a BATCH header and runs them
+static void serve_batch(char *const fields[4]) {
+    int n = atoi(fields[3]);
+    if (n < 1 || n > BATCH_MAX_FILES) n = 0;
+    char **names = calloc(n ? n : 1, sizeof(char *));
+    int *ops = calloc(n ? n : 1, sizeof(int));
+    int got = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    for (; got < n && getline(&line, &cap, stdin) > 0; got++) {
+        char *name;
+        if (parse_batch_line(line, &name, &ops[got]) < 0) { name = line; ops[got] = OP_UNKNOWN; }
+        names[got] = strdup(name);
+    }
+    free(line);
+    if (got == 0) {
+        report_t r;
+        report_init(&r, OP_BATCH);
+        report_error(&r, "batch", EINVAL);
+        print_report(&r);
+    } else {
+        run_batch(fields[1], fields[2], names, ops, got);
+    }
+    for (int i = 0; i < got; i++) free(names[i]);
+    free(names);
+    free(ops);
+}
+
+// persistent mode: one task per line on stdin as
+// "<source>\t<target>\t<filename>\t<operation>\n", or a BATCH header and
+// its file lines (see fss_proto.h); one exec_report per task
+static int serve_tasks(void) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, stdin)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        char *fields[4];
+        char *p = line;
+        int n = 0;
+        for (; n < 4 && p; n++) {
+            fields[n] = p;
+            p = strchr(p, '\t');
+            if (p) *p++ = '\0';
+        }
+        if (n != 4) {
+            report_t r;
+            report_init(&r, OP_UNKNOWN);
+            report_error(&r, "task", EINVAL);
+            print_report(&r);
+            continue;
+        }
+        if (!strcmp(fields[0], "BATCH")) serve_batch(fields);
+        else run_task(fields[0], fields[1], fields[2], fields[3]);
+    }
+    free(line);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int serve = 0, opt;
+    while ((opt = getopt(argc, argv, "bpuPj:F:")) != -1) {
+        switch (opt) {
+            case 'b': binary_reports = 1; break;
+            case 'u': use_uring = 1; break;
+            case 'P': delta_in_place = 1; break;
+            case 'p': serve = 1; binary_reports = 1; break;
+            case 'j': full_threads = atoi(optarg); break;
+            case 'F': if (parse_fsync_policy(optarg) < 0) serve = -1; break;
+            default: serve = -1; break;
+        }
+    }
+    if (full_threads < 1) full_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (full_threads < 1) full_threads = 1;
+    if (full_threads > MAX_THREADS) full_threads = MAX_THREADS;
+    crc32c_init();
+    if (serve == 1 && optind == argc)
+        return serve_tasks();
+    if (serve != 0 || argc - optind != 4) {
+        fprintf(stderr, "Usage: %s [-b] [-u] [-P] [-j threads] [-F none|file|batch[:files[:ms]]] <source> <target> <filename> <operation>\n"
+                        "       %s [-u] [-P] [-j threads] [-F policy] -p   (read tasks from stdin)\n", argv[0], argv[0]);
+        return 1;
+    }
+    run_task(argv[optind], argv[optind + 1], argv[optind + 2], argv[optind + 3]);
     return 0;
 }